@@ -32,8 +32,8 @@ align 4
 	dd FLAGS
 	dd CHECKSUM
 
-section .dma_buff:
-    resb 0x8000
+section .dma_buff nobits alloc write align=16
+    resb 0x10000
 
 
 section .multiboot.text
@@ -88,9 +88,8 @@ stack_bottom:
     resb 0x40000
 stack_top:
 
-; Heap
-section .heap
-align 16
+; Heap, block cache and file system caches live here
+section .heap nobits alloc write align=16
 heap_start:
-    resb 0x40000
+    resb 0x100000
 heap_end:
@@ -138,3 +138,24 @@ void irq_handler(registers_t r){
         interrupt_handlers[r.int_no](r);
     }
 }
+
+uint32_t interrupts_save(){
+    uint32_t flags;
+    __asm__ __volatile__("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+void interrupts_restore(uint32_t flags){
+    __asm__ __volatile__("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+int interrupts_enabled(){
+    uint32_t flags;
+    __asm__ __volatile__("pushf; pop %0" : "=r" (flags));
+    return (flags & 0x200) != 0;
+}
+
+void interrupts_wait(){
+    // sti takes effect after hlt starts so no interrupt can slip in between
+    __asm__ __volatile__("sti; hlt; cli" : : : "memory");
+}
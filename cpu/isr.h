@@ -90,5 +90,12 @@ void isr_handler(registers_t r);
 void register_interrupt_handler(uint8_t n, isr_t handler);
 void irq_handler(registers_t r);
 
+// Disables interrupts returning previous EFLAGS for interrupts_restore
+uint32_t interrupts_save();
+void     interrupts_restore(uint32_t flags);
+int      interrupts_enabled();
+// Halts till the next interrupt, has to be called with interrupts disabled and leaves them disabled
+void     interrupts_wait();
+
 
 #endif //FILEOS_ISR_H
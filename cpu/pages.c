@@ -30,3 +30,17 @@ void __attribute__((section(".multiboot.text"))) setup_table(){
     page_directory[769] = ((uint32_t)third_page_table)  | 3;
 
 }
+
+uint32_t pages_physical_address(void* address){
+    uint32_t virtual_address = (uint32_t)address;
+    uint32_t directory_entry = page_directory[virtual_address >> 22];
+    if(!(directory_entry & 1))
+        return 0;
+
+    // Page tables lie in the identity mapped first megabytes
+    uint32_t* table = (uint32_t*)(directory_entry & 0xFFFFF000);
+    uint32_t table_entry = table[(virtual_address >> 12) & 0x3FF];
+    if(!(table_entry & 1))
+        return 0;
+    return (table_entry & 0xFFFFF000) | (virtual_address & 0xFFF);
+}
@@ -5,6 +5,9 @@
 #ifndef FILEOS_PAGES_H
 #define FILEOS_PAGES_H
 
+#include "types.h"
 
+// Walks page tables, returns 0 if address isn't mapped
+uint32_t pages_physical_address(void* address);
 
 #endif //FILEOS_PAGES_H
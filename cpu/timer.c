@@ -5,6 +5,22 @@
 #include "timer.h"
 #include "../drivers/ports.h"
 
+#define PIT_FREQUENCY      1193182
+#define CALIBRATION_MS     10
+#define CALIBRATION_POLLS  10000000 // Gives up if PIT channel 2 doesn't count down
+
+static volatile uint32_t ticks = 0;
+static uint32_t frequency = 0;
+static uint32_t cycles_per_us = 0; // TSC rate, 0 until calibrated
+static uint32_t slow_clock = 0;    // Microseconds counted by port delays without calibrated TSC
+static timer_callback_t callbacks[TIMER_CALLBACKS];
+
+static void     tick_handler(registers_t regs);
+static int      tsc_present();
+static uint64_t read_tsc();
+static uint32_t us_to_ticks(uint32_t us);
+static void     io_delay();
+
 void init_timer(uint32_t freq, isr_t handler){
     register_interrupt_handler(IRQ0, handler);
 
@@ -16,3 +32,136 @@ void init_timer(uint32_t freq, isr_t handler){
     port_byte_out(0x40, low);
     port_byte_out(0x40, high);
 }
+
+void timer_start(uint32_t freq){
+    frequency = freq;
+    init_timer(freq, tick_handler);
+    timer_calibrate();
+}
+
+void timer_calibrate(){
+    if(!tsc_present())
+        return;
+
+    // Channel 2 counts down once in mode 0 with its gate up and the speaker off, OUT2 is visible in port 0x61
+    uint16_t count = PIT_FREQUENCY * CALIBRATION_MS / 1000;
+    port_byte_out(0x61, (port_byte_in(0x61) & ~0x02) | 0x01);
+    port_byte_out(0x43, 0xB0);
+    port_byte_out(0x42, (uint8_t)(count & 0xFF));
+    port_byte_out(0x42, (uint8_t)(count >> 8));
+
+    uint64_t start = read_tsc();
+    uint32_t polls = 0;
+    while(!(port_byte_in(0x61) & 0x20))
+        if(++polls == CALIBRATION_POLLS)
+            return;
+    uint64_t elapsed = read_tsc() - start;
+
+    // 10 ms of cycles fits in 32 bits below 400 GHz, which avoids 64 bit division
+    if(elapsed >> 32)
+        return;
+    cycles_per_us = (uint32_t)elapsed / (CALIBRATION_MS * 1000);
+}
+
+uint32_t timer_ticks(){
+    return ticks;
+}
+
+uint32_t timer_frequency(){
+    return frequency;
+}
+
+int      timer_register_callback(timer_callback_t callback){
+    for (uint32_t i = 0; i < TIMER_CALLBACKS; i++) {
+        if(callbacks[i] == callback)
+            return 1;
+        if(!callbacks[i]){
+            callbacks[i] = callback;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint32_t timer_cycles_per_us(){
+    return cycles_per_us;
+}
+
+void udelay(uint32_t us){
+    uint64_t deadline = timer_deadline(us);
+    while(!timer_expired(deadline));
+}
+
+void ndelay(uint32_t ns){
+    if(ns >= 1000){
+        udelay((ns + 999) / 1000);
+        return;
+    }
+    if(!cycles_per_us){
+        io_delay(); // Longer than any delay below a microsecond
+        return;
+    }
+    uint64_t end = read_tsc() + ns * cycles_per_us / 1000 + 1;
+    while(read_tsc() < end);
+}
+
+// TSC cycle, otherwise PIT tick (0 if PIT isn't running) in the upper half and slow clock in the lower one
+uint64_t timer_deadline(uint32_t us){
+    if(cycles_per_us)
+        return read_tsc() + (uint64_t)us * cycles_per_us;
+
+    uint32_t tick_deadline = frequency ? ticks + us_to_ticks(us) + 1 : 0;
+    return ((uint64_t)tick_deadline << 32) | (uint32_t)(slow_clock + us);
+}
+
+int      timer_expired(uint64_t deadline){
+    if(cycles_per_us)
+        return read_tsc() >= deadline;
+
+    // Slow clock only advances when polled, PIT ticks keep real time between rare checks
+    io_delay();
+    slow_clock++;
+    uint32_t tick_deadline = (uint32_t)(deadline >> 32);
+    if(tick_deadline && (int32_t)(ticks - tick_deadline) >= 0)
+        return 1;
+    return (int32_t)(slow_clock - (uint32_t)deadline) >= 0;
+}
+
+///
+/// Static helper functions
+///
+
+static void tick_handler(registers_t regs __attribute__((unused))){
+    ticks++;
+    for (uint32_t i = 0; i < TIMER_CALLBACKS && callbacks[i]; i++)
+        callbacks[i](ticks);
+}
+
+// CPUID leaf 1 reports TSC in bit 4 of edx, CPUID itself exists if ID flag of EFLAGS can be toggled
+static int      tsc_present(){
+    uint32_t before, after;
+    __asm__ volatile("pushf; pop %0; mov %0, %1; xor $0x200000, %1; push %1; popf; pushf; pop %1; push %0; popf"
+                     : "=&r" (before), "=&r" (after));
+    if(!((before ^ after) & 0x200000))
+        return 0;
+
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    return (edx & 0x10) != 0;
+}
+
+static uint64_t read_tsc(){
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a" (low), "=d" (high));
+    return ((uint64_t)high << 32) | low;
+}
+
+// Rounded up, split to stay in 32 bits
+static uint32_t us_to_ticks(uint32_t us){
+    return us / 1000000 * frequency + ((us % 1000000 + 999) / 1000 * frequency + 999) / 1000;
+}
+
+// Writes to the unused POST port take about a microsecond on the ISA bus
+static void     io_delay(){
+    port_byte_out(0x80, 0);
+}
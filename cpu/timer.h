@@ -10,4 +10,30 @@
 
 void init_timer(uint32_t freq, isr_t handler);
 
+// Starts PIT counting ticks at given frequency
+void     timer_start(uint32_t freq);
+uint32_t timer_ticks();
+// 0 if timer wasn't started
+uint32_t timer_frequency();
+
+#define TIMER_CALLBACKS 8
+
+// Called from the timer interrupt on every tick with interrupts disabled, has to return quickly
+typedef void (*timer_callback_t)(uint32_t ticks);
+// Returns 0 if every slot is taken
+int      timer_register_callback(timer_callback_t callback);
+
+// Measures TSC rate against PIT channel 2, called by timer_start. Until then delays rely on slow port I/O
+void     timer_calibrate();
+// 0 if TSC isn't calibrated
+uint32_t timer_cycles_per_us();
+
+// Busy wait at least given time, interrupts may be disabled
+void     udelay(uint32_t us);
+void     ndelay(uint32_t ns);
+
+// Polling with timeout: take a deadline before the loop and give up once it expired
+uint64_t timer_deadline(uint32_t us);
+int      timer_expired(uint64_t deadline);
+
 #endif //FILEOS_TIMER_H
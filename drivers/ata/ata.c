@@ -1,12 +1,37 @@
 #include "ata.h"
 #include "ata_types.h"
 
-static ATA_DEVICE devices[2]; // There can be up to 2 drives on one line
+#include "../../cpu/isr.h"
+#include "../../cpu/pages.h"
+#include "../../cpu/timer.h"
+#include "../pci.h"
+#include "../../libc/math.h"
 
-static const uint32_t PORT_BASE = 0x1F0;
-static const uint32_t CONTROL_BASE = 0x3F6;
+static ATA_PRD prd_tables[2][ATA_PRD_ENTRIES] __attribute__((aligned(ATA_PRD_ENTRIES * sizeof(ATA_PRD)))); // Can't cross 64 KiB
+
+static ATA_CHANNEL channels[2] = {
+    { .port_base = 0x1F0, .control_base = 0x3F6, .irq = IRQ14 },
+    { .port_base = 0x170, .control_base = 0x376, .irq = IRQ15 },
+};
+static ATA_DEVICE devices[4]; // There can be up to 2 drives on each channel
 
 static int identify_ata(ATA_DEVICE* device, uint16_t port_base, uint16_t control_base, enum AtaDrive drive);
+static int set_multiple_mode(ATA_DEVICE* device, uint16_t sectors);
+
+static void init_bus_master();
+static uint32_t build_prd_table(ATA_CHANNEL* channel, uint8_t* buffer, uint32_t size);
+static void start_command(ATA_CHANNEL* channel);
+static int  write_taskfile(ATA_DEVICE* device, uint32_t lba, uint32_t count);
+static uint8_t pio_command(ATA_DEVICE* device, enum AtaDirection direction);
+static uint32_t pio_block(ATA_CHANNEL* channel);
+static void finish_request(ATA_CHANNEL* channel, enum E_DEVICE result);
+static void abort_command(ATA_CHANNEL* channel);
+static void channel_interrupt(ATA_CHANNEL* channel);
+static void dma_interrupt(ATA_CHANNEL* channel);
+static void primary_handler(registers_t regs);
+static void secondary_handler(registers_t regs);
+static uint8_t wait_not_busy(ATA_DEVICE* device);
+static uint8_t select_delay(ATA_DEVICE* device);
 
 static void ata_write_bytes(ATA_DEVICE* device, uint8_t* buffer, uint32_t size);
 
@@ -19,109 +44,406 @@ static void ata_write_reg(ATA_DEVICE* device, enum AtaRegister reg, uint16_t val
 static uint16_t ata_read_control_reg(ATA_DEVICE* device, enum AtaControlRegister reg);
 static void ata_write_control_reg(ATA_DEVICE* device, enum AtaControlRegister reg, uint8_t val);
 
-static uint16_t ata_read_data(ATA_DEVICE* device);
-static void ata_write_data(ATA_DEVICE* device, uint16_t data);
-
 int ata_init(enum AtaMode mode){
     VFS_DEVICE* device;
     VFS_PARTITION* _partitions;
     uint32_t _size;
 
-    int d1 = identify_ata(&devices[0], PORT_BASE, CONTROL_BASE, ATA_MASTER);
-    if(!d1)
-        vfs_device_register(&devices[0], ata_pio_read, ata_pio_write, &device);
-    vfs_partitions_find_on_device(device, PARTITION_FORMAT_FAT32, &_partitions, &_size);
-
-    int d2 = identify_ata(&devices[1], PORT_BASE, CONTROL_BASE, ATA_SLAVE);
-    if(!d2)
-        vfs_device_register(&devices[1], ata_pio_read, ata_pio_write, &device);
-    vfs_partitions_find_on_device(device, PARTITION_FORMAT_FAT32, &_partitions, &_size);
-
-    return d1 && d2;
-}
-
-enum E_DEVICE ata_pio_read(struct VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
-    ATA_DEVICE* dev = vfs_device_get_data(device);
-
-    uint32_t amount = sectors / 256;
-    uint32_t reminder = sectors % 256;
-    for (int k = 0; k <= amount; k++) {
-        // Send LBA
-        uint16_t slave_bit = (dev->drive & 0x10);
-        ata_write_reg(dev, ATA_DRIVE_REGISTER,(0xE0 | slave_bit) | ((lba >> 24) & 0x0F));
-        if(k < amount){
-            ata_write_reg(dev, ATA_SECTOR_COUNT_REGISTER, 0);
-        }else{
-            if(reminder == 0) return 0;
-            ata_write_reg(dev, ATA_SECTOR_COUNT_REGISTER, reminder);
+    register_interrupt_handler(channels[0].irq, primary_handler);
+    register_interrupt_handler(channels[1].irq, secondary_handler);
+    if(mode == ATA_DMA)
+        init_bus_master();
+
+    int found = 0;
+    for (int i = 0; i < 4; i++) {
+        ATA_CHANNEL* channel = &channels[i / 2];
+        if(identify_ata(&devices[i], channel->port_base, channel->control_base, i % 2 ? ATA_SLAVE : ATA_MASTER))
+            continue;
+        devices[i].channel = channel;
+        if(mode == ATA_DMA && channel->bus_master && devices[i].dma_supported)
+            devices[i].default_mode = ATA_DMA;
+        // PIO moves whole blocks of sectors per data request if the drive accepts the block size
+        if(devices[i].multiple_sectors && set_multiple_mode(&devices[i], devices[i].multiple_sectors))
+            devices[i].multiple_sectors = 0;
+
+        // Clear nIEN so the drive raises IRQ when it needs attention
+        ata_write_control_reg(&devices[i], ATA_DEVICE_CONTROL_REGISTER, 0x00);
+        if(vfs_device_register(&devices[i], ata_read, ata_write, &device) != E_DEVICE_OK)
+            continue;
+        vfs_partitions_find_on_device(device, PARTITION_FORMAT_FAT32, &_partitions, &_size);
+        found++;
+    }
+
+    return !found;
+}
+
+enum E_DEVICE ata_submit(ATA_REQUEST* request){
+    if(!request || !request->device || !request->device->channel)
+        return E_DEVICE_NOT_FOUND;
+    if(!request->buffer)
+        return E_DEVICE_TOO_SMALL_BUFFER;
+    if(request->sectors == 0)
+        return request->direction == ATA_READ ? E_DEVICE_BAD_READ : E_DEVICE_BAD_WRITE;
+    if((uint64_t)request->lba + request->sectors > request->device->addressable_sectors)
+        return E_DEVICE_BAD_SECTOR;
+
+    request->done = 0;
+    request->finished = 0;
+    request->result = E_DEVICE_OK;
+    request->next = 0;
+
+    // Queue is shared with the interrupt handler
+    ATA_CHANNEL* channel = request->device->channel;
+    uint32_t flags = interrupts_save();
+    if(channel->tail)
+        channel->tail->next = request;
+    else
+        channel->head = request;
+    channel->tail = request;
+    if(!channel->active)
+        start_command(channel);
+    interrupts_restore(flags);
+    return E_DEVICE_OK;
+}
+
+enum E_DEVICE ata_wait(ATA_REQUEST* request){
+    ATA_CHANNEL* channel = request->device->channel;
+    int polling = !interrupts_enabled();
+    uint32_t flags = interrupts_save();
+    while(!request->finished){
+        if(channel->active && timer_expired(channel->deadline)){
+            abort_command(channel);
+            continue;
         }
-        ata_write_reg(dev, ATA_LBALO_REGISTER, (uint8_t)lba);
-        ata_write_reg(dev, ATA_LBAMID_REGISTER, (uint8_t)(lba >> 8));
-        ata_write_reg(dev, ATA_LBAHI_REGISTER, (uint8_t)(lba >> 16));
-
-        // READ SECTORS command
-        ata_write_reg(dev, ATA_COMMAND_REGISTER, 0x20);
-
-        for (int i = 0; i < (sectors & 0xFF); i++) {
-            uint16_t polling = ata_read_reg(dev, ATA_STATUS_REGISTER);
-            while((polling & 0x80) && !(polling & 0x20) && !(polling & 0x01))
-                polling = ata_read_reg(dev, ATA_STATUS_REGISTER);
-            if(polling & 0x21)
-                return 1;
-            ata_read_bytes(dev, buffer, 512);
-            buffer += 512;
-
-            // Wait for around 400 ms
-            for (int j = 0; j < 15; j++)
-                ata_read_reg(dev, ATA_STATUS_REGISTER);
+
+        // Nothing would deliver the interrupt, check the drive instead
+        if(polling){
+            // Drive might not have turned busy after the last transfer yet
+            if(!(select_delay(request->device) & ATA_STATUS_BUSY))
+                channel_interrupt(channel);
+            continue;
         }
+        interrupts_wait();
+    }
+    interrupts_restore(flags);
+    return request->result;
+}
+
+enum E_DEVICE ata_read(struct VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
+    ATA_REQUEST request = {
+        .device = vfs_device_get_data(device),
+        .direction = ATA_READ,
+        .buffer = buffer,
+        .lba = lba,
+        .sectors = sectors,
+    };
+    enum E_DEVICE result = ata_submit(&request);
+    if(result != E_DEVICE_OK)
+        return result;
+    return ata_wait(&request);
+}
+
+enum E_DEVICE ata_write(struct VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
+    ATA_REQUEST request = {
+        .device = vfs_device_get_data(device),
+        .direction = ATA_WRITE,
+        .buffer = buffer,
+        .lba = lba,
+        .sectors = sectors,
+    };
+    enum E_DEVICE result = ata_submit(&request);
+    if(result != E_DEVICE_OK)
+        return result;
+    return ata_wait(&request);
+}
+
+// Sends command for the next part of the request at the head of the queue, interrupts have to be disabled
+static void start_command(ATA_CHANNEL* channel){
+    ATA_REQUEST* request = channel->head;
+    ATA_DEVICE* dev = request->device;
+    int lba48 = dev->addressing_mode == ATA_LBA48;
+    uint32_t lba = request->lba + request->done;
+    uint32_t count = min(request->sectors - request->done, lba48 ? ATA_LBA48_MAX_SECTORS : ATA_LBA28_MAX_SECTORS);
+    channel->active = 1;
+
+    // Buffers that can't be described for the controller go through PIO, long ones might get shortened
+    uint32_t described = dev->default_mode == ATA_DMA ?
+                         build_prd_table(channel, request->buffer + request->done * 512, count * 512) : 0;
+    channel->dma = described != 0;
+    if(channel->dma){
+        count = described / 512;
+        uint8_t bm_status = port_byte_in(channel->bus_master + ATA_BM_STATUS_REGISTER);
+        port_dword_out(channel->bus_master + ATA_BM_PRDT_REGISTER, pages_physical_address(channel->prdt));
+        port_byte_out(channel->bus_master + ATA_BM_COMMAND_REGISTER,
+                      request->direction == ATA_READ ? ATA_BM_TO_MEMORY : 0);
+        port_byte_out(channel->bus_master + ATA_BM_STATUS_REGISTER, bm_status | ATA_BM_ERROR | ATA_BM_INTERRUPT);
+    }
+    channel->command_left = count;
+    channel->deadline = timer_deadline(ATA_COMMAND_TIMEOUT_US);
+    if(write_taskfile(dev, lba, count)){
+        finish_request(channel, request->direction == ATA_READ ? E_DEVICE_READ_FAILED : E_DEVICE_WRITE_FAILED);
+        return;
+    }
+
+    if(channel->dma){
+        // Controller moves everything, drive interrupts once at the end
+        uint8_t command = request->direction == ATA_READ ?
+                          (lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA) :
+                          (lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA);
+        ata_write_reg(dev, ATA_COMMAND_REGISTER, command);
+        port_byte_out(channel->bus_master + ATA_BM_COMMAND_REGISTER,
+                      (request->direction == ATA_READ ? ATA_BM_TO_MEMORY : 0) | ATA_BM_START);
+        return;
+    }
+
+    // Drive interrupts once every block is ready
+    ata_write_reg(dev, ATA_COMMAND_REGISTER, pio_command(dev, request->direction));
+    if(request->direction == ATA_READ)
+        return;
+
+    // First block is sent without waiting for an interrupt, the rest after each one
+    select_delay(dev);
+    uint8_t status = wait_not_busy(dev);
+    if((status & (ATA_STATUS_BUSY | ATA_STATUS_ERROR | ATA_STATUS_DRIVE_FAULT)) || !(status & ATA_STATUS_DATA_REQUEST)){
+        finish_request(channel, E_DEVICE_WRITE_FAILED);
+        return;
     }
+    uint32_t block = pio_block(channel);
+    ata_write_bytes(dev, request->buffer + request->done * 512, block * 512);
+    request->done += block;
+    channel->command_left -= block;
+}
+
+// Selects the drive and sets up address and sector count (0 means the maximum) of the next command,
+// returns non zero if the drive didn't get ready
+static int  write_taskfile(ATA_DEVICE* device, uint32_t lba, uint32_t count){
+    uint16_t slave_bit = (device->drive & 0x10);
+    if(device->addressing_mode == ATA_LBA48)
+        ata_write_reg(device, ATA_DRIVE_REGISTER, 0x40 | slave_bit);
+    else
+        ata_write_reg(device, ATA_DRIVE_REGISTER, (0xE0 | slave_bit) | ((lba >> 24) & 0x0F));
+    select_delay(device);
+    if(wait_not_busy(device) & ATA_STATUS_BUSY)
+        return 1;
 
+    // Registers keep two bytes each, high ones go first
+    if(device->addressing_mode == ATA_LBA48){
+        ata_write_reg(device, ATA_SECTOR_COUNT_REGISTER, (uint8_t)(count >> 8));
+        ata_write_reg(device, ATA_LBALO_REGISTER, (uint8_t)(lba >> 24));
+        ata_write_reg(device, ATA_LBAMID_REGISTER, 0); // Bits 32-47, LBA passed around is 32 bits wide
+        ata_write_reg(device, ATA_LBAHI_REGISTER, 0);
+    }
+    ata_write_reg(device, ATA_SECTOR_COUNT_REGISTER, (uint8_t)count);
+    ata_write_reg(device, ATA_LBALO_REGISTER, (uint8_t)lba);
+    ata_write_reg(device, ATA_LBAMID_REGISTER, (uint8_t)(lba >> 8));
+    ata_write_reg(device, ATA_LBAHI_REGISTER, (uint8_t)(lba >> 16));
     return 0;
 }
 
-enum E_DEVICE ata_pio_write(struct VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
-    ATA_DEVICE* dev = vfs_device_get_data(device);
-
-    uint32_t amount = sectors / 256;
-    uint32_t reminder = sectors % 256;
-    for (int k = 0; k <= amount; k++) {
-        // Send LBA
-        uint16_t slave_bit = (dev->drive & 0x10);
-        ata_write_reg(dev, ATA_DRIVE_REGISTER,(0xE0 | slave_bit) | ((lba >> 24) & 0x0F));
-        if(k < amount){
-            ata_write_reg(dev, ATA_SECTOR_COUNT_REGISTER, 0);
-        }else{
-            if(reminder == 0) return 0;
-            ata_write_reg(dev, ATA_SECTOR_COUNT_REGISTER, reminder);
-        }
-        ata_write_reg(dev, ATA_LBALO_REGISTER, (uint8_t)lba);
-        ata_write_reg(dev, ATA_LBAMID_REGISTER, (uint8_t)(lba >> 8));
-        ata_write_reg(dev, ATA_LBAHI_REGISTER, (uint8_t)(lba >> 16));
-
-        // WRITE SECTORS command
-        ata_write_reg(dev, ATA_COMMAND_REGISTER, 0x30);
-
-        for (int i = 0; i < (sectors & 0xFF); i++) {
-            uint16_t polling = ata_read_reg(dev, ATA_STATUS_REGISTER);
-            while((polling & 0x80) && !(polling & 0x20) && !(polling & 0x01))
-                polling = ata_read_reg(dev, ATA_STATUS_REGISTER);
-            if(polling & 0x21)
-                return 1;
-            ata_write_bytes(dev, buffer, 512);
-            buffer+=512;
-
-            // Wait for around 400 ms
-            for (int j = 0; j < 15; j++)
-                ata_read_reg(dev, ATA_STATUS_REGISTER);
+static uint8_t pio_command(ATA_DEVICE* device, enum AtaDirection direction){
+    int lba48 = device->addressing_mode == ATA_LBA48;
+    if(device->multiple_sectors > 1){
+        if(direction == ATA_READ)
+            return lba48 ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+        return lba48 ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+    }
+    if(direction == ATA_READ)
+        return lba48 ? ATA_CMD_READ_SECTORS_EXT : ATA_CMD_READ_SECTORS;
+    return lba48 ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_WRITE_SECTORS;
+}
+
+// Sectors moved by the next data request of a PIO command, last block might be shorter
+static uint32_t pio_block(ATA_CHANNEL* channel){
+    uint32_t block = channel->head->device->multiple_sectors;
+    return min(channel->command_left, block > 1 ? block : 1);
+}
+
+// Removes finished request from the queue and starts the next one
+static void finish_request(ATA_CHANNEL* channel, enum E_DEVICE result){
+    ATA_REQUEST* request = channel->head;
+    channel->head = request->next;
+    if(!channel->head)
+        channel->tail = 0;
+    channel->active = 0;
+    channel->command_left = 0;
+
+    request->result = result;
+    request->finished = 1;
+    if(request->complete)
+        request->complete(request);
+    if(channel->head && !channel->active)
+        start_command(channel);
+}
+
+// Fails the command the drive didn't finish in time and resets both drives of the channel
+static void abort_command(ATA_CHANNEL* channel){
+    ATA_REQUEST* request = channel->head;
+    if(channel->dma){
+        port_byte_out(channel->bus_master + ATA_BM_COMMAND_REGISTER, 0);
+        port_byte_out(channel->bus_master + ATA_BM_STATUS_REGISTER, ATA_BM_ERROR | ATA_BM_INTERRUPT);
+    }
+
+    // SRST has to stay set for at least 5 us, nIEN stays clear
+    port_byte_out(channel->control_base + ATA_DEVICE_CONTROL_REGISTER, 0x04);
+    udelay(5);
+    port_byte_out(channel->control_base + ATA_DEVICE_CONTROL_REGISTER, 0x00);
+    finish_request(channel, request->direction == ATA_READ ? E_DEVICE_READ_FAILED : E_DEVICE_WRITE_FAILED);
+}
+
+static void channel_interrupt(ATA_CHANNEL* channel){
+    ATA_REQUEST* request = channel->head;
+    if(request && channel->active && channel->dma){
+        dma_interrupt(channel);
+        return;
+    }
+
+    // Reading status acknowledges the interrupt even if nothing waits for it
+    uint8_t status = port_byte_in(channel->port_base + ATA_STATUS_REGISTER);
+    if(!request || (status & ATA_STATUS_BUSY))
+        return;
+
+    if(status & (ATA_STATUS_ERROR | ATA_STATUS_DRIVE_FAULT)){
+        finish_request(channel, request->direction == ATA_READ ? E_DEVICE_READ_FAILED : E_DEVICE_WRITE_FAILED);
+        return;
+    }
+
+    if(request->direction == ATA_READ){
+        if(!(status & ATA_STATUS_DATA_REQUEST))
+            return;
+        uint32_t block = pio_block(channel);
+        ata_read_bytes(request->device, request->buffer + request->done * 512, block * 512);
+        request->done += block;
+        channel->command_left -= block;
+    }else if(channel->command_left > 0){
+        // Previous block is written, drive wants the next one
+        if(!(status & ATA_STATUS_DATA_REQUEST))
+            return;
+        uint32_t block = pio_block(channel);
+        ata_write_bytes(request->device, request->buffer + request->done * 512, block * 512);
+        request->done += block;
+        channel->command_left -= block;
+        return;
+    }
+
+    if(channel->command_left > 0)
+        return;
+    if(request->done < request->sectors)
+        start_command(channel);
+    else
+        finish_request(channel, E_DEVICE_OK);
+}
+
+static void dma_interrupt(ATA_CHANNEL* channel){
+    ATA_REQUEST* request = channel->head;
+    uint8_t bm_status = port_byte_in(channel->bus_master + ATA_BM_STATUS_REGISTER);
+    uint8_t drive_status = (uint8_t)ata_read_control_reg(request->device, ATA_ALTERNATE_STATUS_REGISTER);
+    if(!(bm_status & ATA_BM_INTERRUPT) && (bm_status & ATA_BM_ACTIVE) && !(drive_status & ATA_STATUS_ERROR))
+        return; // Not finished yet
+
+    // Stop the controller, then acknowledge both the drive and the controller
+    port_byte_out(channel->bus_master + ATA_BM_COMMAND_REGISTER, 0);
+    uint8_t status = port_byte_in(channel->port_base + ATA_STATUS_REGISTER);
+    port_byte_out(channel->bus_master + ATA_BM_STATUS_REGISTER, bm_status | ATA_BM_ERROR | ATA_BM_INTERRUPT);
+    if((status & (ATA_STATUS_ERROR | ATA_STATUS_DRIVE_FAULT)) || (bm_status & ATA_BM_ERROR)){
+        finish_request(channel, request->direction == ATA_READ ? E_DEVICE_READ_FAILED : E_DEVICE_WRITE_FAILED);
+        return;
+    }
+
+    request->done += channel->command_left;
+    channel->command_left = 0;
+    if(request->done < request->sectors)
+        start_command(channel);
+    else
+        finish_request(channel, E_DEVICE_OK);
+}
+
+static void primary_handler(registers_t regs __attribute__((unused))){
+    channel_interrupt(&channels[0]);
+}
+
+static void secondary_handler(registers_t regs __attribute__((unused))){
+    channel_interrupt(&channels[1]);
+}
+
+static void init_bus_master(){
+    PCI_ADDRESS controller;
+    if(pci_find_class(0x01, 0x01, &controller)) // Mass storage, IDE
+        return;
+    if(!(controller.interface & 0x80)) // Not capable of bus mastering
+        return;
+    uint32_t bar = pci_config_read(&controller, PCI_BAR4);
+    if(!(bar & 0x01)) // Registers have to be in I/O space
+        return;
+
+    uint32_t command = pci_config_read(&controller, PCI_COMMAND) & 0xFFFF;
+    pci_config_write(&controller, PCI_COMMAND, command | PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+    for (int i = 0; i < 2; i++) {
+        channels[i].bus_master = (uint16_t)((bar & 0xFFFC) + i * 8);
+        channels[i].prdt = prd_tables[i];
+    }
+}
+
+// Describes buffer in the channel's PRD table, returns how many bytes (whole sectors) fit in it, 0 if none
+static uint32_t build_prd_table(ATA_CHANNEL* channel, uint8_t* buffer, uint32_t size){
+    if((uint32_t)buffer & 1)
+        return 0;
+
+    uint32_t entries = 0;
+    uint32_t described = 0;
+    while(described < size && entries < ATA_PRD_ENTRIES){
+        uint32_t address = pages_physical_address(buffer + described);
+        if(address == 0)
+            break;
+
+        // Grow over pages mapped one after another, not crossing 64 KiB boundary
+        uint32_t left = size - described;
+        uint32_t length = min(left, 0x1000 - (address & 0xFFF));
+        while(length < left && ((address + length) & 0xFFFF) != 0 &&
+              pages_physical_address(buffer + described + length) == address + length)
+            length = min(left, length + 0x1000);
+        length = min(length, 0x10000 - (address & 0xFFFF));
+
+        channel->prdt[entries].address = address;
+        channel->prdt[entries].size = (uint16_t)length; // 64 KiB turns into 0 as it should
+        channel->prdt[entries].flags = 0;
+        entries++;
+        described += length;
+    }
+
+    // Drop a partially described sector
+    uint32_t excess = described % 512;
+    while(excess > 0){
+        uint32_t length = channel->prdt[entries - 1].size ? channel->prdt[entries - 1].size : 0x10000;
+        if(length > excess){
+            channel->prdt[entries - 1].size = (uint16_t)(length - excess);
+            break;
         }
+        excess -= length;
+        entries--;
     }
-    return 0;
+    described -= described % 512;
+    if(described == 0)
+        return 0;
+    channel->prdt[entries - 1].flags = ATA_PRD_END;
+    return described;
 }
 
-static int identify_ata(ATA_DEVICE* device, uint16_t port_base, uint16_t control_base, enum AtaDrive drive){
-    int error = 0;
+// Returns the first status without busy flag or the busy one after a timeout, reading it doesn't acknowledge interrupts
+static uint8_t wait_not_busy(ATA_DEVICE* device){
+    uint64_t deadline = timer_deadline(ATA_BUSY_TIMEOUT_US);
+    uint8_t status = (uint8_t)ata_read_control_reg(device, ATA_ALTERNATE_STATUS_REGISTER);
+    while((status & ATA_STATUS_BUSY) && !timer_expired(deadline))
+        status = (uint8_t)ata_read_control_reg(device, ATA_ALTERNATE_STATUS_REGISTER);
+    return status;
+}
 
+// Status is valid 400 ns after selecting a drive or sending a command, returns it without acknowledging interrupts
+static uint8_t select_delay(ATA_DEVICE* device){
+    ndelay(400);
+    return (uint8_t)ata_read_control_reg(device, ATA_ALTERNATE_STATUS_REGISTER);
+}
+
+static int identify_ata(ATA_DEVICE* device, uint16_t port_base, uint16_t control_base, enum AtaDrive drive){
     // Initialize device data
     device->port_base = port_base;
     device->control_base = control_base;
@@ -140,7 +462,7 @@ static int identify_ata(ATA_DEVICE* device, uint16_t port_base, uint16_t control
     ata_write_reg(device, ATA_LBALO_REGISTER, 0);
     ata_write_reg(device, ATA_LBAMID_REGISTER, 0);
     ata_write_reg(device, ATA_LBAHI_REGISTER, 0);
-    ata_write_reg(device, ATA_COMMAND_REGISTER, 0xEC); // TODO: Add enums for commands
+    ata_write_reg(device, ATA_COMMAND_REGISTER, ATA_CMD_IDENTIFY);
 
     // Check status register
     uint16_t status = ata_read_reg(device, ATA_STATUS_REGISTER);
@@ -148,9 +470,13 @@ static int identify_ata(ATA_DEVICE* device, uint16_t port_base, uint16_t control
         return 4;
 
     // Wait for busy flag to clear
+    uint64_t deadline = timer_deadline(ATA_BUSY_TIMEOUT_US);
     uint16_t polling_value = ata_read_reg(device, ATA_STATUS_REGISTER);
-    while (polling_value & 0x80)
+    while (polling_value & 0x80){
+        if(timer_expired(deadline))
+            return 5;
         polling_value = ata_read_reg(device, ATA_STATUS_REGISTER);
+    }
 
     // Check for different types of ATA
     uint16_t lba_mid = ata_read_reg(device, ATA_LBAMID_REGISTER);
@@ -159,8 +485,11 @@ static int identify_ata(ATA_DEVICE* device, uint16_t port_base, uint16_t control
         return 2;
 
     // Check for errors
-    while (!(polling_value & 0x08) && !(polling_value & 0x01))
+    while (!(polling_value & 0x08) && !(polling_value & 0x01)){
+        if(timer_expired(deadline))
+            return 5;
         polling_value = ata_read_reg(device, ATA_STATUS_REGISTER);
+    }
     if(polling_value & 0x01)
         return 3;
 
@@ -168,55 +497,60 @@ static int identify_ata(ATA_DEVICE* device, uint16_t port_base, uint16_t control
     uint16_t buffer[256];
     ata_read_words(device, buffer, 256);
 
-    // TODO: support for 48-bit LBA
-    uint32_t low = buffer[60];
-    uint32_t high = buffer[61] << 16; // TODO: check if this is correct conversion
-    device->addressable_sectors = low | high;
+    // Words 60-61 count sectors reachable with LBA28, 100-103 with LBA48 if bit 10 of word 83 says it's supported
+    device->addressable_sectors = (uint32_t)buffer[60] | ((uint32_t)buffer[61] << 16);
+    if(buffer[83] & 0x0400){
+        device->addressing_mode = ATA_LBA48;
+        device->addressable_sectors = (uint64_t)buffer[100] | ((uint64_t)buffer[101] << 16) |
+                                      ((uint64_t)buffer[102] << 32) | ((uint64_t)buffer[103] << 48);
+    }
+    device->dma_supported = (buffer[49] & 0x0100) != 0;
+
+    // Low byte of word 47 is the largest block READ/WRITE MULTIPLE can move, some drives only take powers of 2
+    device->multiple_sectors = 0;
+    uint16_t max_block = buffer[47] & 0xFF;
+    if(max_block > 1){
+        device->multiple_sectors = 1;
+        while(device->multiple_sectors * 2 <= max_block)
+            device->multiple_sectors *= 2;
+    }
 
     return 0;
 }
 
+// Returns non zero if the drive refused the block size
+static int set_multiple_mode(ATA_DEVICE* device, uint16_t sectors){
+    ata_write_reg(device, ATA_DRIVE_REGISTER, device->drive);
+    select_delay(device);
+    wait_not_busy(device);
+    ata_write_reg(device, ATA_SECTOR_COUNT_REGISTER, sectors);
+    ata_write_reg(device, ATA_COMMAND_REGISTER, ATA_CMD_SET_MULTIPLE_MODE);
+    select_delay(device);
+    uint8_t status = wait_not_busy(device);
+    ata_read_reg(device, ATA_STATUS_REGISTER); // Acknowledge the interrupt
+    return status & (ATA_STATUS_BUSY | ATA_STATUS_ERROR | ATA_STATUS_DRIVE_FAULT);
+}
+
+// Data register is 16 bits wide, little endian words land in the buffer in the right byte order
 static void ata_write_bytes(ATA_DEVICE* device, uint8_t* buffer, uint32_t size){
-    for (uint32_t i = 0; i < size; i+=2){
-        uint16_t tmp = ((uint16_t)(buffer[i + 1]) << 8) | ((uint16_t)buffer[i]);
-        ata_write_data(device, tmp);
-    }
+    port_words_out(device->port_base + ATA_DATA_REGISTER, buffer, size / 2);
 }
 
 static void ata_read_bytes(ATA_DEVICE* device, uint8_t* buffer, uint32_t size){
-    for (uint32_t i = 0; i < size; i+=2){
-        uint16_t tmp = ata_read_data(device);
-        buffer[i + 1] = ((tmp & 0xFF00) >> 8);
-        buffer[i] = (uint8_t)tmp;
-    }
+    port_words_in(device->port_base + ATA_DATA_REGISTER, buffer, size / 2);
 }
 
 static void ata_read_words(ATA_DEVICE* device, uint16_t* buffer, uint32_t size){
-    for (uint32_t i = 0; i < size; i++)
-        *(buffer++) = ata_read_data(device);
+    port_words_in(device->port_base + ATA_DATA_REGISTER, buffer, size);
 }
 
+// Registers are 8 bits wide in every addressing mode, LBA48 writes them twice
 static uint16_t ata_read_reg(ATA_DEVICE* device, enum AtaRegister reg){
-    uint16_t value;
-    if(device->addressing_mode == ATA_LBA28 || reg > 5){
-        uint8_t tmp = port_byte_in(device->port_base + reg);
-        value = (uint16_t)tmp;
-    }
-    else{
-        value = port_word_in(device->port_base + reg);
-    }
-    return value;
+    return port_byte_in(device->port_base + reg);
 }
 
-// If send 8 bytes than send lower byte
 static void ata_write_reg(ATA_DEVICE* device, enum AtaRegister reg, uint16_t val){
-    if(device->addressing_mode == ATA_LBA28 || reg > 5){
-        uint8_t tmp = (uint8_t)val;
-        port_byte_out(device->port_base + reg, tmp);
-    }
-    else{
-        port_word_out(device->port_base + reg, val);
-    }
+    port_byte_out(device->port_base + reg, (uint8_t)val);
 }
 
 static void ata_write_control_reg(ATA_DEVICE* device, enum AtaControlRegister reg, uint8_t val){
@@ -226,12 +560,3 @@ static void ata_write_control_reg(ATA_DEVICE* device, enum AtaControlRegister re
 static uint16_t ata_read_control_reg(ATA_DEVICE* device, enum AtaControlRegister reg){
     return port_byte_in(device->control_base + reg);
 }
-
-
-static uint16_t ata_read_data(ATA_DEVICE* device){
-    return port_word_in(device->port_base + ATA_DATA_REGISTER);
-}
-
-static void ata_write_data(ATA_DEVICE* device, uint16_t data){
-    port_word_out(device->port_base + ATA_DATA_REGISTER, data);
-}
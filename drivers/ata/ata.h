@@ -6,8 +6,15 @@
 #include "../../fs/vfs.h"
 
 int ata_init(enum AtaMode mode);
-enum E_DEVICE ata_pio_read(struct VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
-enum E_DEVICE ata_pio_write(struct VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+
+// Queues request on the channel of its drive and returns without waiting for the transfer
+enum E_DEVICE ata_submit(ATA_REQUEST* request);
+// Sleeps till request is finished (polls the drive if interrupts are off) and returns its result
+enum E_DEVICE ata_wait(ATA_REQUEST* request);
+
+// Blocking transfers built on ata_submit/ata_wait, in the drive's default mode
+enum E_DEVICE ata_read(struct VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+enum E_DEVICE ata_write(struct VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
 
 
 #endif // ATA_H_
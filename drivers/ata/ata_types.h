@@ -2,6 +2,7 @@
 #define ATA_TYPES_H_
 
 #include "../../cpu/types.h"
+#include "../../fs/vfs.h"
 
 enum AtaRegister { // Offsets
     ATA_DATA_REGISTER = 0,
@@ -22,6 +23,45 @@ enum AtaControlRegister {
     ATA_DRIVE_ADDRESS_REGISTER = 1,
 };
 
+enum AtaBusMasterRegister { // Offsets from the channel's bus master base
+    ATA_BM_COMMAND_REGISTER = 0,
+    ATA_BM_STATUS_REGISTER = 2,
+    ATA_BM_PRDT_REGISTER = 4,
+};
+
+enum AtaBusMasterBits {
+    ATA_BM_START = 0x01,        // Command register
+    ATA_BM_TO_MEMORY = 0x08,    // Command register, set when reading from the drive
+    ATA_BM_ACTIVE = 0x01,       // Status register
+    ATA_BM_ERROR = 0x02,        // Status register, cleared by writing 1
+    ATA_BM_INTERRUPT = 0x04,    // Status register, cleared by writing 1
+};
+
+enum AtaStatus {
+    ATA_STATUS_ERROR = 0x01,
+    ATA_STATUS_DATA_REQUEST = 0x08,
+    ATA_STATUS_DRIVE_FAULT = 0x20,
+    ATA_STATUS_READY = 0x40,
+    ATA_STATUS_BUSY = 0x80,
+};
+
+enum AtaCommand {
+    ATA_CMD_READ_SECTORS = 0x20,
+    ATA_CMD_WRITE_SECTORS = 0x30,
+    ATA_CMD_READ_SECTORS_EXT = 0x24,
+    ATA_CMD_READ_DMA_EXT = 0x25,
+    ATA_CMD_READ_MULTIPLE_EXT = 0x29,
+    ATA_CMD_WRITE_SECTORS_EXT = 0x34,
+    ATA_CMD_WRITE_DMA_EXT = 0x35,
+    ATA_CMD_WRITE_MULTIPLE_EXT = 0x39,
+    ATA_CMD_READ_MULTIPLE = 0xC4,
+    ATA_CMD_WRITE_MULTIPLE = 0xC5,
+    ATA_CMD_SET_MULTIPLE_MODE = 0xC6,
+    ATA_CMD_READ_DMA = 0xC8,
+    ATA_CMD_WRITE_DMA = 0xCA,
+    ATA_CMD_IDENTIFY = 0xEC,
+};
+
 enum AtaError {
     E_ATA_ADDRESS_MARK_NOT_FOUND = 0x01,
     E_ATA_TRACK_ZERO_NOT_FOUND = 0x02,
@@ -35,6 +75,7 @@ enum AtaError {
 
 enum AtaMode {
     ATA_PIO = 0,
+    ATA_DMA = 1, // Bus master IDE, falls back to PIO without a PCI IDE controller
 };
 
 enum AtaDrive {
@@ -48,6 +89,22 @@ enum AtaAddressingMode {
     ATA_CHS,
 };
 
+// Most sectors a single command can transfer
+#define ATA_LBA28_MAX_SECTORS 256
+#define ATA_LBA48_MAX_SECTORS 65536
+
+// Longest waits for the drive before giving up
+#define ATA_BUSY_TIMEOUT_US    1000000  // Registers accessible again
+#define ATA_COMMAND_TIMEOUT_US 10000000 // Whole command, covers spinning up
+
+enum AtaDirection {
+    ATA_READ = 0,
+    ATA_WRITE = 1,
+};
+
+typedef struct ATA_CHANNEL ATA_CHANNEL;
+typedef struct ATA_REQUEST ATA_REQUEST;
+
 typedef struct {
     // Drive mode
     enum AtaMode default_mode;
@@ -57,9 +114,57 @@ typedef struct {
     uint16_t port_base;
     uint16_t control_base;
     enum AtaDrive drive;
+    ATA_CHANNEL* channel;
 
     // Drive info
-    uint32_t addressable_sectors;
+    uint64_t addressable_sectors;
+    int dma_supported;
+    uint16_t multiple_sectors; // Sectors moved per data request by READ/WRITE MULTIPLE, 0 if not used
 } ATA_DEVICE;
 
+// Called from the interrupt handler once request is finished, the request may be submitted again from it
+typedef void (*ATA_COMPLETE)(ATA_REQUEST* request);
+
+struct ATA_REQUEST {
+    // Filled by the submitter
+    ATA_DEVICE* device;
+    enum AtaDirection direction;
+    uint8_t* buffer;
+    uint32_t lba;
+    uint32_t sectors;
+    ATA_COMPLETE complete; // May be 0
+    void* data;            // Not used by the driver
+
+    // Filled by the driver
+    uint32_t done; // Sectors transferred so far
+    volatile int finished;
+    enum E_DEVICE result;
+    ATA_REQUEST* next;
+};
+
+// Physical Region Descriptor, one physically contiguous piece of a DMA transfer
+typedef struct {
+    uint32_t address;
+    uint16_t size;  // 0 means 64 KiB
+    uint16_t flags;
+} __attribute__((packed)) ATA_PRD;
+
+#define ATA_PRD_END     0x8000 // Set in the last descriptor of a table
+#define ATA_PRD_ENTRIES 512    // 32 MiB if memory is contiguous, longer commands are split
+
+// Drives on one cable share registers so their requests are served one at a time
+struct ATA_CHANNEL {
+    uint16_t port_base;
+    uint16_t control_base;
+    uint8_t  irq;
+    uint16_t bus_master; // Bus master IDE registers, 0 without DMA
+    ATA_PRD* prdt;
+    ATA_REQUEST* head; // Request being transferred
+    ATA_REQUEST* tail;
+    int      active;       // Command of the head request was sent to the drive
+    int      dma;          // That command transfers data with DMA
+    uint32_t command_left; // Sectors left in that command
+    uint64_t deadline;     // Timer deadline of that command
+};
+
 #endif // ATA_TYPES_H_
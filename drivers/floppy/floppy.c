@@ -11,17 +11,16 @@
 #include "../screen.h"
 #include "floppy_dma.h"
 #include "floppy_pio.h"
-
-struct FloppyModeFunctions {
-    int (*read)(FLOPPY_DEVICE*, uint8_t*, uint32_t, uint32_t);
-    int (*write)(FLOPPY_DEVICE*, uint8_t*, uint32_t, uint32_t);
-};
+#include "floppy_cache.h"
 
 // Floppies structs
 static FLOPPY_DEVICE floppies[2];
 static uint8_t current_drive = 0;
 static struct FloppyModeFunctions current_mode;
 
+static enum E_DEVICE device_error(int error, enum E_DEVICE failed);
+static int           in_range(const FLOPPY_DEVICE* drive, uint32_t sectors, uint32_t lba);
+
 
 int floppy_init(FloppyMode mode) {
     int error = 0;
@@ -60,11 +59,58 @@ int floppy_init(FloppyMode mode) {
     }
 
     floppy_detect_drives(&floppies[0]);
+    floppy_motor_init();
+
+    // Detected drives become block devices, file systems on them are mounted like on ATA disks
+    for (int i = 0; i < 2; i++) {
+        VFS_DEVICE* device;
+        VFS_PARTITION* _partitions;
+        uint32_t _size;
+        if(floppies[i].type == F_NO_DRIVE)
+            continue;
+        if(vfs_device_register(&floppies[i], floppy_read, floppy_write, &device) != E_DEVICE_OK)
+            continue;
+        vfs_partitions_find_on_device(device, PARTITION_FORMAT_FAT12 | PARTITION_FORMAT_FAT16 | PARTITION_FORMAT_FAT32,
+                                      &_partitions, &_size);
+    }
     return error;
 }
 
-int floppy_read(struct VFS_DEVICE *device, uint8_t *buffer, uint32_t sectors, uint32_t lba) {
+void floppy_set_motor_idle(uint32_t ms) {
+    floppy_motor_set_idle(ms);
+}
+
+enum E_DEVICE floppy_read(VFS_DEVICE *device, void *buffer, uint32_t sectors, uint32_t lba) {
+    FLOPPY_DEVICE* drive = vfs_device_get_data(device);
+    if(!drive || drive->type == F_NO_DRIVE)
+        return E_DEVICE_NOT_FOUND;
+    if(!in_range(drive, sectors, lba))
+        return E_DEVICE_BAD_SECTOR;
+    return device_error(floppy_cache_read(drive, &current_mode, buffer, sectors, lba), E_DEVICE_READ_FAILED);
+}
+
+enum E_DEVICE floppy_write(VFS_DEVICE *device, void *buffer, uint32_t sectors, uint32_t lba) {
+    FLOPPY_DEVICE* drive = vfs_device_get_data(device);
+    if(!drive || drive->type == F_NO_DRIVE)
+        return E_DEVICE_NOT_FOUND;
+    if(!in_range(drive, sectors, lba))
+        return E_DEVICE_BAD_SECTOR;
+    return device_error(floppy_cache_write(drive, &current_mode, buffer, sectors, lba), E_DEVICE_WRITE_FAILED);
+}
+
+///
+/// Static helper functions
+///
+
+static enum E_DEVICE device_error(int error, enum E_DEVICE failed) {
+    if(!(error & E_ERROR))
+        return E_DEVICE_OK;
+    if((error & ~(ED_FLOPPY | E_ERROR)) == E_FLOPPY_NOT_WRITABLE)
+        return E_DEVICE_NOT_WRITABLE;
+    return failed;
 }
 
-int floppy_write(struct VFS_DEVICE *device, uint8_t *buffer, uint32_t sectors, uint32_t lba) {
+static int           in_range(const FLOPPY_DEVICE* drive, uint32_t sectors, uint32_t lba) {
+    uint32_t total = drive->cylinders * drive->heads * drive->sectors_per_track;
+    return sectors && lba < total && sectors <= total - lba;
 }
@@ -10,8 +10,11 @@
 #include "../../fs/vfs.h"
 
 int floppy_init(FloppyMode mode);
+// How long motors keep spinning after the last access, 0 stops them right away
+void floppy_set_motor_idle(uint32_t ms);
 
-int floppy_read(struct VFS_DEVICE *device, uint8_t *buffer, uint32_t sectors, uint32_t lba);
-int floppy_write(struct VFS_DEVICE *device, uint8_t *buffer, uint32_t sectors, uint32_t lba);
+// Block device functions of detected drives, registered with the VFS by floppy_init
+enum E_DEVICE floppy_read(VFS_DEVICE *device, void *buffer, uint32_t sectors, uint32_t lba);
+enum E_DEVICE floppy_write(VFS_DEVICE *device, void *buffer, uint32_t sectors, uint32_t lba);
 
 #endif //FILEOS_FLOPPY_H
@@ -0,0 +1,92 @@
+#include "floppy_cache.h"
+#include "../../kernel/util.h"
+#include "../../libc/memory.h"
+#include "../../libc/math.h"
+
+static int      init_cache(FLOPPY_DEVICE* drive);
+static int      load_cylinder(FLOPPY_DEVICE* drive, const struct FloppyModeFunctions* mode, uint16_t cylinder);
+static uint32_t cylinder_sectors(const FLOPPY_DEVICE* drive);
+
+int  floppy_cache_read(FLOPPY_DEVICE* drive, const struct FloppyModeFunctions* mode,
+                       uint8_t* buffer, uint32_t sectors, uint32_t lba){
+    if(!init_cache(drive))
+        return mode->read(drive, buffer, sectors, lba);
+
+    FLOPPY_TRACK_CACHE* cache = &drive->cache;
+    uint32_t per_cylinder = cylinder_sectors(drive);
+
+    // Requests of a cylinder or more go to the drive whole, disk is never behind the cached copy
+    if(sectors >= per_cylinder)
+        return mode->read(drive, buffer, sectors, lba);
+
+    uint32_t done = 0;
+    while(done < sectors){
+        uint16_t cylinder = (lba + done) / per_cylinder;
+        uint32_t first = (lba + done) % per_cylinder;
+        uint32_t count = min(sectors - done, per_cylinder - first);
+
+        int error = load_cylinder(drive, mode, cylinder);
+        if(error)
+            return error;
+        k_memcpy(cache->buffer + first * 512, buffer + done * 512, (int)(count * 512));
+        done += count;
+    }
+    return E_FLOPPY_NO_ERROR;
+}
+
+int  floppy_cache_write(FLOPPY_DEVICE* drive, const struct FloppyModeFunctions* mode,
+                        uint8_t* buffer, uint32_t sectors, uint32_t lba){
+    if(!init_cache(drive))
+        return mode->write(drive, buffer, sectors, lba);
+
+    FLOPPY_TRACK_CACHE* cache = &drive->cache;
+    int error = mode->write(drive, buffer, sectors, lba);
+    if(error)
+        return error;
+
+    // Keep the cached copy up to date
+    if(cache->valid){
+        uint32_t per_cylinder = cylinder_sectors(drive);
+        uint32_t start = cache->cylinder * per_cylinder;
+        uint32_t from = max(lba, start);
+        uint32_t to = min(lba + sectors, start + per_cylinder);
+        if(from < to)
+            k_memcpy(buffer + (from - lba) * 512, cache->buffer + (from - start) * 512, (int)((to - from) * 512));
+    }
+    return E_FLOPPY_NO_ERROR;
+}
+
+///
+/// Static helper functions
+///
+
+// Returns 0 if the drive can't be cached
+static int      init_cache(FLOPPY_DEVICE* drive){
+    uint32_t per_cylinder = cylinder_sectors(drive);
+    if(per_cylinder == 0 || per_cylinder > FLOPPY_MAX_CYLINDER_SECTORS)
+        return 0;
+
+    // Allocated on first use, heap isn't ready when drives are detected
+    if(!drive->cache.buffer)
+        drive->cache.buffer = k_malloc(FLOPPY_MAX_CYLINDER_SECTORS * 512);
+    return drive->cache.buffer != 0;
+}
+
+static int      load_cylinder(FLOPPY_DEVICE* drive, const struct FloppyModeFunctions* mode, uint16_t cylinder){
+    FLOPPY_TRACK_CACHE* cache = &drive->cache;
+    if(cache->valid && cache->cylinder == cylinder)
+        return E_FLOPPY_NO_ERROR;
+
+    cache->valid = 0;
+    uint32_t per_cylinder = cylinder_sectors(drive);
+    int error = mode->read(drive, cache->buffer, per_cylinder, cylinder * per_cylinder);
+    if(error)
+        return error;
+    cache->cylinder = cylinder;
+    cache->valid = 1;
+    return E_FLOPPY_NO_ERROR;
+}
+
+static uint32_t cylinder_sectors(const FLOPPY_DEVICE* drive){
+    return drive->heads * drive->sectors_per_track;
+}
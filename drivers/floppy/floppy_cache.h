@@ -0,0 +1,14 @@
+#ifndef FILEOS_FLOPPY_CACHE_H
+#define FILEOS_FLOPPY_CACHE_H
+
+#include "floppy_types.h"
+
+// Reads go through a per-drive copy of the last used cylinder, which is loaded with a single command.
+// Requests of a cylinder or more bypass it
+int  floppy_cache_read(FLOPPY_DEVICE* drive, const struct FloppyModeFunctions* mode,
+                       uint8_t* buffer, uint32_t sectors, uint32_t lba);
+// Writes through to the disk and updates the cached cylinder
+int  floppy_cache_write(FLOPPY_DEVICE* drive, const struct FloppyModeFunctions* mode,
+                        uint8_t* buffer, uint32_t sectors, uint32_t lba);
+
+#endif //FILEOS_FLOPPY_CACHE_H
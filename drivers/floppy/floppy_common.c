@@ -4,10 +4,19 @@
 
 #include "floppy_common.h"
 #include "../../fs/vfs.h"
+#include "../../cpu/timer.h"
+#include "../../cpu/isr.h"
 
 // Digital Output Register
 uint8_t DOR;
 
+static volatile enum FloppyMotorState motor_state[4];
+static volatile uint32_t              motor_off_tick[4];
+static uint32_t                       motor_idle_ms = FLOPPY_MOTOR_IDLE_MS;
+
+static void motor_stop(uint8_t drive);
+static void motor_tick(uint32_t ticks);
+
 int get_MSR(){
     return port_byte_in(MAIN_STATUS_REGISTER);
 }
@@ -21,17 +30,21 @@ void send_FIFO(uint8_t byte){
 }
 
 int floppy_write_cmd(uint8_t cmd){
-    for (int i = 0; i < 600; ++i)
+    uint64_t deadline = timer_deadline(FLOPPY_RQM_TIMEOUT_US);
+    do {
         if((get_MSR() & RQM)) {
             send_FIFO(cmd);
             return E_FLOPPY_NO_ERROR;
         }
+    } while(!timer_expired(deadline));
     return E_FLOPPY_TIMEOUT | ED_FLOPPY | E_ERROR;
 }
 
 uint8_t floppy_read_data(){
-    for (int i = 0; i < 600; ++i)
+    uint64_t deadline = timer_deadline(FLOPPY_RQM_TIMEOUT_US);
+    do {
         if((get_MSR() & RQM)) return get_FIFO();
+    } while(!timer_expired(deadline));
     return 0;
 }
 
@@ -45,6 +58,13 @@ DMA lba_2_chs(uint32_t lba, const FLOPPY_DEVICE* drive)
     return dma;
 }
 
+uint32_t floppy_command_sectors(const FLOPPY_DEVICE* drive, DMA dma, uint32_t sectors)
+{
+    uint32_t first = dma.head * drive->sectors_per_track + dma.sector - 1;
+    uint32_t left = drive->heads * drive->sectors_per_track - first;
+    return sectors < left ? sectors : left;
+}
+
 void set_floppy_params(enum FloppyType type, uint8_t drive, FLOPPY_DEVICE *drive_struct) {
     drive_struct->type         = type;
     drive_struct->drive_number = drive;
@@ -110,21 +130,61 @@ void floppy_sense_interrupt(uint32_t *st0, uint32_t *cyl){
     *cyl = floppy_read_data();
 }
 
+void floppy_motor_init() {
+    timer_register_callback(motor_tick);
+}
+
 void floppy_motor(int on, uint8_t drive) {
-    if(on)
-        DOR = (DOR & 0x0f) | (0x1 << (drive + 4));
-    else
-        DOR = (DOR & 0x0f);
+    drive &= 0x03;
+    uint32_t flags = interrupts_save();
+    if(on){
+        // Idle motor is still at speed, the pending stop is simply cancelled
+        int stopped = motor_state[drive] == floppy_motor_off;
+        motor_state[drive] = floppy_motor_on;
+        if(stopped){
+            DOR |= MOTA << drive;
+            port_byte_out(DIGITAL_OUTPUT_REGISTER, DOR);
+        }
+        interrupts_restore(flags);
+        if(stopped)
+            udelay(FLOPPY_MOTOR_SPINUP_US);
+        return;
+    }
+
+    // Without a running timer nothing would stop the motor later
+    uint32_t frequency = timer_frequency();
+    if(motor_state[drive] == floppy_motor_on && frequency && motor_idle_ms){
+        motor_off_tick[drive] = timer_ticks() + (motor_idle_ms * frequency + 999) / 1000;
+        motor_state[drive] = floppy_motor_idle;
+    }else if(motor_state[drive] != floppy_motor_idle)
+        motor_stop(drive);
+    interrupts_restore(flags);
+}
+
+void floppy_motor_kill() {
+    uint32_t flags = interrupts_save();
+    for (uint8_t drive = 0; drive < 4; drive++)
+        motor_state[drive] = floppy_motor_off;
+    DOR &= 0x0f;
     port_byte_out(DIGITAL_OUTPUT_REGISTER, DOR);
+    interrupts_restore(flags);
+}
+
+void floppy_motor_set_idle(uint32_t ms) {
+    motor_idle_ms = ms;
 }
 
 void set_DOR(uint8_t data){
+    uint32_t flags = interrupts_save();
     DOR = (DOR & 0xf0) | (data & 0x0f);
     port_byte_out(DIGITAL_OUTPUT_REGISTER, DOR);
+    interrupts_restore(flags);
 }
 
 void select_drive(uint8_t drive_number){
+    uint32_t flags = interrupts_save();
     DOR = (DOR & 0xfc) | (drive_number & 0x03);
+    interrupts_restore(flags);
 }
 
 int calculate_error(const uint8_t* st0, const uint8_t* st1, const uint8_t* st2, const uint8_t* bps){
@@ -147,3 +207,21 @@ int calculate_error(const uint8_t* st0, const uint8_t* st1, const uint8_t* st2,
     return error;
 }
 
+
+///
+/// Static helper functions
+///
+
+// Interrupts have to be disabled
+static void motor_stop(uint8_t drive){
+    motor_state[drive] = floppy_motor_off;
+    DOR &= ~(MOTA << drive);
+    port_byte_out(DIGITAL_OUTPUT_REGISTER, DOR);
+}
+
+// Runs in timer interrupt
+static void motor_tick(uint32_t ticks){
+    for (uint8_t drive = 0; drive < 4; drive++)
+        if(motor_state[drive] == floppy_motor_idle && (int32_t)(ticks - motor_off_tick[drive]) >= 0)
+            motor_stop(drive);
+}
@@ -21,12 +21,19 @@ uint8_t get_FIFO();
 void send_FIFO(uint8_t byte);
 
 DMA lba_2_chs(uint32_t lba, const FLOPPY_DEVICE* drive);
+// Sectors one command can transfer starting at given position, MT flag carries it from head 0 onto head 1
+uint32_t floppy_command_sectors(const FLOPPY_DEVICE* drive, DMA dma, uint32_t sectors);
 
 // Common floppy functions
 void floppy_sense_interrupt(uint32_t *st0, uint32_t *cyl);
 
+// Turning the motor on waits for spin up only if it was stopped, turning it off is deferred to the timer
+void floppy_motor_init();
 void floppy_motor(int on, uint8_t drive);
+// Stops every motor right away
 void floppy_motor_kill();
+// 0 turns motors off as soon as an operation ends
+void floppy_motor_set_idle(uint32_t ms);
 
 void set_DOR(uint8_t data);
 
@@ -4,59 +4,96 @@
 
 #include "floppy_dma.h"
 #include "../../cpu/isr.h"
+#include "../../cpu/timer.h"
 #include "../../kernel/util.h"
 #include "../../fs/vfs.h"
 #include "../../libc/math.h"
 
-static int floppy_dma_init(enum FloppyTransmitDirection dir, uint32_t size);
-static enum FloppyErrors floppy_do_track(const FLOPPY_DEVICE *drive, DMA dma, enum FloppyTransmitDirection dir, uint32_t size, uint32_t *seg_read);
+static int floppy_dma_init(enum FloppyTransmitDirection dir, uint8_t* buffer, uint32_t size);
+static uint32_t floppy_segment(const FLOPPY_DEVICE *drive, uint32_t lba, uint32_t sectors);
+static int floppy_seek_track(const FLOPPY_DEVICE *drive, DMA dma);
+static int floppy_issue(const FLOPPY_DEVICE *drive, DMA dma, enum FloppyTransmitDirection dir, uint8_t* buffer, uint32_t sectors);
+static int floppy_result();
+static int floppy_do_track(const FLOPPY_DEVICE *drive, DMA dma, enum FloppyTransmitDirection dir, uint8_t* buffer, uint32_t sectors);
 static int floppy_calibrate(const FLOPPY_DEVICE *drive);
 static int floppy_seek(uint8_t cyli, uint32_t head, const FLOPPY_DEVICE *drive);
 static int floppy_reset(const FLOPPY_DEVICE *drive);
 
-// Transfer buffer
-#define floppy_dmalen 0x8000
+// Transfer buffer, its halves take turns so that the CPU copies one while the controller works on the other
+#define floppy_dmalen  0x10000
+#define floppy_dmahalf (floppy_dmalen / 2)
 extern unsigned int _DMA_BUFFER_POS;
 uint8_t* floppy_dmabuf = (uint8_t *) &_DMA_BUFFER_POS;
 
-// TODO - Add timeouts
 volatile int floppy_dma_waiting = 1;
 void irq6_handler(registers_t regs){
     floppy_dma_waiting = 0;
 }
 
-static void floppy_wait(){
-    while(floppy_dma_waiting);
+// Returns non zero if IRQ6 didn't come in time
+static int floppy_wait(){
+    uint64_t deadline = timer_deadline(FLOPPY_IRQ_TIMEOUT_US);
+    while(floppy_dma_waiting && !timer_expired(deadline));
+    int timeout = floppy_dma_waiting;
     floppy_dma_waiting = 1;
+    return timeout;
 }
 
 
 // Public functions
 int read_floppy_dma(FLOPPY_DEVICE *drive, uint8_t* buffer, uint32_t sectors, uint32_t lba){
-    uint32_t seg_read, total_sectors = 0;
+    if(drive->type == F_NO_DRIVE) return E_FLOPPY_NO_DRIVE | ED_FLOPPY | E_ERROR;
+    uint32_t total_sectors = 0, copy_sectors = 0, half = 0;
+    uint8_t* copy_from = floppy_dmabuf;
 
     while(total_sectors < sectors){
+        uint8_t* dmabuf = floppy_dmabuf + half * floppy_dmahalf;
+        uint32_t count = floppy_segment(drive, lba + total_sectors, sectors - total_sectors);
         DMA dma = lba_2_chs(lba + total_sectors, drive);
-        uint32_t size = min(512 * (sectors - total_sectors), 512 * 8); // TODO - maybe solve in better way
-        // Gives page fault when there's more than 4KB of mem
-        int error = floppy_do_track(drive, dma, floppy_dir_read, size, &seg_read);
+        if(floppy_seek_track(drive, dma)) return -1;
+        int error = floppy_issue(drive, dma, floppy_dir_read, dmabuf, count);
+
+        // Previous half is copied out while the controller fills this one
+        k_memcpy(copy_from, (char*)(buffer + (total_sectors - copy_sectors) * 512), (int)(512 * copy_sectors));
+
+        if(!error) error = floppy_result();
+        if(error) error = floppy_do_track(drive, dma, floppy_dir_read, dmabuf, count);
         if(error & E_ERROR) return error;
-        k_memcpy(floppy_dmabuf, (char*)(buffer + total_sectors * 512), (int)(512 * seg_read));
-        total_sectors += seg_read;
+        floppy_motor(0, drive->drive_number);
+        copy_from = dmabuf;
+        copy_sectors = count;
+        total_sectors += count;
+        half ^= 1;
     }
+    k_memcpy(copy_from, (char*)(buffer + (total_sectors - copy_sectors) * 512), (int)(512 * copy_sectors));
     return 0;
 
 }
 
 int write_floppy_dma(FLOPPY_DEVICE *drive, uint8_t* buffer, uint32_t sectors, uint32_t lba){
-    uint32_t seg_read, total_sectors = 0;
+    if(drive->type == F_NO_DRIVE) return E_FLOPPY_NO_DRIVE | ED_FLOPPY | E_ERROR;
+    uint32_t total_sectors = 0, half = 0;
+    uint32_t count = floppy_segment(drive, lba, sectors);
+    k_memcpy((char*)buffer, floppy_dmabuf, (int)(512 * count));
+
     while(total_sectors < sectors){
-        uint32_t size = min(512 * (sectors - total_sectors), 512 * 8);
+        uint8_t* dmabuf = floppy_dmabuf + half * floppy_dmahalf;
         DMA dma = lba_2_chs(lba + total_sectors, drive);
-        k_memcpy((char*)buffer, floppy_dmabuf, (int)size);
-        int error = floppy_do_track(drive, dma, floppy_dir_write, size, &seg_read);
+        if(floppy_seek_track(drive, dma)) return -1;
+        int error = floppy_issue(drive, dma, floppy_dir_write, dmabuf, count);
+
+        // Next segment is copied into the other half while the controller writes this one
+        uint32_t next = total_sectors + count;
+        uint32_t next_count = next < sectors ? floppy_segment(drive, lba + next, sectors - next) : 0;
+        k_memcpy((char*)(buffer + next * 512), floppy_dmabuf + (half ^ 1) * floppy_dmahalf, (int)(512 * next_count));
+
+        if(!error) error = floppy_result();
+        if(error) error = floppy_do_track(drive, dma, floppy_dir_write, dmabuf, count);
         if(error & E_ERROR) return error;
-        total_sectors += seg_read;
+        floppy_motor(0, drive->drive_number);
+        total_sectors = next;
+        count = next_count;
+        half ^= 1;
     }
     return 0;
 }
@@ -67,13 +104,13 @@ void init_floppy_dma() {
 }
 
 // Private functions
-static int floppy_dma_init(enum FloppyTransmitDirection dir, uint32_t size){
+static int floppy_dma_init(enum FloppyTransmitDirection dir, uint8_t* buffer, uint32_t size){
     union {
         uint8_t b[4];
         uint32_t l;
     } a, c;
 
-    a.l = (uint32_t) floppy_dmabuf;
+    a.l = (uint32_t) buffer;
     c.l = (uint32_t) size - 1;
 
     if(size > floppy_dmalen) {
@@ -117,9 +154,21 @@ static int floppy_dma_init(enum FloppyTransmitDirection dir, uint32_t size){
     return E_FLOPPY_NO_ERROR;
 }
 
-static enum FloppyErrors floppy_do_track(const FLOPPY_DEVICE *drive, DMA dma, enum FloppyTransmitDirection dir, uint32_t size, uint32_t *seg_read) {
-    if(drive->type == F_NO_DRIVE) return E_FLOPPY_NO_DRIVE | ED_FLOPPY | E_ERROR;
+// Sectors of the next command, each has to fit in a half of the buffer
+static uint32_t floppy_segment(const FLOPPY_DEVICE *drive, uint32_t lba, uint32_t sectors) {
+    return floppy_command_sectors(drive, lba_2_chs(lba, drive), min(sectors, floppy_dmahalf / 512));
+}
+
+// seek both heads
+static int floppy_seek_track(const FLOPPY_DEVICE *drive, DMA dma) {
     select_drive(drive->drive_number);
+    if(floppy_seek(dma.cylinder, 0, drive)) return -1;
+    if(floppy_seek(dma.cylinder, 1, drive)) return -1;
+    return 0;
+}
+
+// Starts transfer of sectors on the seeked cylinder, IRQ6 signals its end
+static int floppy_issue(const FLOPPY_DEVICE *drive, DMA dma, enum FloppyTransmitDirection dir, uint8_t* buffer, uint32_t sectors) {
     uint8_t cmd;
 
     switch(dir) {
@@ -130,57 +179,61 @@ static enum FloppyErrors floppy_do_track(const FLOPPY_DEVICE *drive, DMA dma, en
             cmd = WRITE_DATA | MT | MF;
             break;
         default:
-            return E_FLOPPY_INVALID_DATA_DIRECTION; // not reached, but pleases "cmd used uninitialized"
+            return E_FLOPPY_INVALID_DATA_DIRECTION | ED_FLOPPY | E_ERROR;
     }
 
-    // TODO - Extract calculating sectors
-    uint32_t sectors = (size / 512) + ((size % 512) != 0);
-    uint32_t final_preview = sectors + dma.sector - 1;
-    uint32_t final = final_preview > drive->sectors_per_track ? drive->sectors_per_track : final_preview;
-    *seg_read = final - dma.sector + 1;
-
+    // Whole cylinder can go with one command, terminal count stops the controller on head 1
+    uint32_t final = min(drive->sectors_per_track, dma.sector + sectors - 1);
 
-    // seek both heads
-    if(floppy_seek(dma.cylinder, 0, drive)) return -1;
-    if(floppy_seek(dma.cylinder, 1, drive)) return -1;
+    floppy_motor(1, drive->drive_number);
 
-    int error = E_FLOPPY_NO_ERROR;
+    int error = floppy_dma_init(dir, buffer, sectors * 512);
+    if(error) return error;
+
+    floppy_write_cmd(cmd);  // set above for current direction
+    floppy_write_cmd(dma.head << 2);    // 0:0:0:0:0:HD:US1:US0 = head and drive
+    floppy_write_cmd(dma.cylinder);   // cylinder
+    floppy_write_cmd(dma.head);  // first head (should match with above)
+    floppy_write_cmd(dma.sector);// first info, strangely counts from 1
+    floppy_write_cmd(2);    // bytes/info, 128*2^x (x=2 -> 512)
+    floppy_write_cmd(final);   // number of tracks to operate on
+    floppy_write_cmd(0x1b); // GAP3 length, 27 is default for 3.5"
+    floppy_write_cmd(0xff); // data length (0xff if B/S != 0)
+    return E_FLOPPY_NO_ERROR;
+}
 
-    for(int i = 0; i < 20; i++) {
-        floppy_motor(1, drive->drive_number);
+// Waits for the issued transfer, returns one of FloppyErrors
+static int floppy_result() {
+    // don't SENSE_INTERRUPT here!
+    if(floppy_wait()) return E_FLOPPY_TIMEOUT;
 
-        // init dma..
-        // TODO - forward errors
-        floppy_dma_init(dir, size);
+    // first read status information
+    unsigned char st0, st1, st2, rcy, rhe, rse, bps;
+    st0 = floppy_read_data();
+    st1 = floppy_read_data();
+    st2 = floppy_read_data();
 
-        floppy_write_cmd(cmd);  // set above for current direction
-        floppy_write_cmd(dma.head << 2);    // 0:0:0:0:0:HD:US1:US0 = head and drive
-        floppy_write_cmd(dma.cylinder);   // cylinder
-        floppy_write_cmd(dma.head);  // first head (should match with above)
-        floppy_write_cmd(dma.sector);// first info, strangely counts from 1
-        floppy_write_cmd(2);    // bytes/info, 128*2^x (x=2 -> 512)
-        floppy_write_cmd(final);   // number of tracks to operate on
-        floppy_write_cmd(0x1b); // GAP3 length, 27 is default for 3.5"
-        floppy_write_cmd(0xff); // data length (0xff if B/S != 0)
 
-        // TODO - Add timeout to wait function
-        floppy_wait(); // don't SENSE_INTERRUPT here!
+    rcy = floppy_read_data();
+    rhe = floppy_read_data();
+    rse = floppy_read_data();
+    // bytes per info, should be what we programmed in
+    bps = floppy_read_data();
 
-        // first read status information
-        unsigned char st0, st1, st2, rcy, rhe, rse, bps;
-        st0 = floppy_read_data();
-        st1 = floppy_read_data();
-        st2 = floppy_read_data();
+    return calculate_error(&st0, &st1, &st2, &bps);
+}
 
+// Transfers sectors and waits for them, retrying failed attempts
+static int floppy_do_track(const FLOPPY_DEVICE *drive, DMA dma, enum FloppyTransmitDirection dir, uint8_t* buffer, uint32_t sectors) {
+    if(floppy_seek_track(drive, dma)) return -1;
 
-        rcy = floppy_read_data();
-        rhe = floppy_read_data();
-        rse = floppy_read_data();
-        // bytes per info, should be what we programmed in
-        bps = floppy_read_data();
+    int error = E_FLOPPY_NO_ERROR;
 
+    for(int i = 0; i < 20; i++) {
+        error = floppy_issue(drive, dma, dir, buffer, sectors);
+        if(error & E_ERROR) return error;
 
-        error = calculate_error(&st0, &st1, &st2, &bps);
+        error = floppy_result();
 
         if(!error){
             floppy_motor(0, drive->drive_number);
@@ -193,10 +246,11 @@ static enum FloppyErrors floppy_do_track(const FLOPPY_DEVICE *drive, DMA dma, en
 }
 
 static int floppy_reset(const FLOPPY_DEVICE *drive) {
-    port_byte_out(DIGITAL_OUTPUT_REGISTER, 0x00);
-    port_byte_out(DIGITAL_OUTPUT_REGISTER, 0x0c);
+    floppy_motor_kill();
+    set_DOR(0x00);
+    set_DOR(0x0c);
 
-    floppy_wait();
+    if(floppy_wait()) return -1;
 
     {
         uint32_t st0, cyl;
@@ -223,7 +277,7 @@ static int floppy_calibrate(const FLOPPY_DEVICE *drive) {
         floppy_write_cmd(RECALIBRATE);
         floppy_write_cmd(0);
 
-        floppy_wait();
+        if(floppy_wait()) continue;
 
         floppy_sense_interrupt(&st0, &cyl);
 
@@ -253,7 +307,7 @@ static int floppy_seek(uint8_t cyli, uint32_t head, const FLOPPY_DEVICE *drive)
         floppy_write_cmd(head << 2);
         floppy_write_cmd(cyli);
 
-        floppy_wait();
+        if(floppy_wait()) continue;
 
         floppy_sense_interrupt(&st0, &cyl);
 
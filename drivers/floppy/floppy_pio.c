@@ -6,6 +6,7 @@
 #include "../../kernel/util.h"
 #include "../../fs/vfs.h"
 #include "../../libc/math.h"
+#include "../../cpu/timer.h"
 
 int floppy_transfer_pio(
         const FLOPPY_DEVICE *drive,
@@ -37,9 +38,10 @@ void init_floppy_pio(){
 // Check for correctness
 int read_floppy_pio(FLOPPY_DEVICE* drive, uint8_t* buffer, uint32_t sectors, uint32_t lba){
     uint32_t seg_read, total_sectors = 0;
-    floppy_buffer = buffer;
 
     while(total_sectors < sectors){
+        floppy_buffer = buffer + total_sectors * 512;
+        floppy_buffer_index = 0;
         DMA dma = lba_2_chs(lba + total_sectors, drive);
         uint32_t size = 512 * (sectors - total_sectors);
         int error = floppy_transfer_pio(drive, dma, floppy_dir_read, size, &seg_read, read_callback);
@@ -51,10 +53,11 @@ int read_floppy_pio(FLOPPY_DEVICE* drive, uint8_t* buffer, uint32_t sectors, uin
 
 int write_floppy_pio(FLOPPY_DEVICE* drive, uint8_t* buffer, uint32_t sectors, uint32_t lba){
     uint32_t seg_read, total_sectors = 0;
-    floppy_buffer = buffer;
 
     while(total_sectors < sectors){
-        uint32_t size = min(512 * (sectors - total_sectors), 512 * drive->sectors_per_track);
+        floppy_buffer = buffer + total_sectors * 512;
+        floppy_buffer_index = 0;
+        uint32_t size = 512 * (sectors - total_sectors);
         DMA dma = lba_2_chs(lba + total_sectors, drive);
         int error = floppy_transfer_pio(drive, dma, floppy_dir_write, size, &seg_read, write_callback);
         if(error & E_ERROR) return error;
@@ -76,10 +79,16 @@ int floppy_transfer_pio(
     select_drive(drive->drive_number);
     // Write appropriate command
 
-    uint32_t sectors = (size / 512) + ((size % 512) != 0);
-    uint32_t final_preview = sectors + dma.sector - 1;
-    uint32_t final = final_preview > drive->sectors_per_track ? drive->sectors_per_track : final_preview;
-    *seg_read = final - dma.sector + 1;
+    // Without terminal count the controller stops only at EOT, so MT may carry the command onto head 1
+    // only when it runs to the end of that track. Otherwise it stays on one head and EOT is the last sector wanted
+    uint32_t spt = drive->sectors_per_track;
+    uint32_t sectors = floppy_command_sectors(drive, dma, (size / 512) + ((size % 512) != 0));
+    uint32_t last = dma.head * spt + dma.sector + sectors - 1;
+    uint8_t multitrack = dma.head == 0 && last == 2 * spt ? MT : 0;
+    if(!multitrack && dma.sector + sectors - 1 > spt)
+        sectors = spt - dma.sector + 1;
+    uint32_t final = multitrack ? spt : dma.sector + sectors - 1;
+    *seg_read = sectors;
     floppy_buffer_size = 512 * sectors;
 
     int error = E_FLOPPY_NO_ERROR;
@@ -87,8 +96,8 @@ int floppy_transfer_pio(
     for (int i = 0; i < 3; ++i) {
         floppy_motor(1, drive->drive_number);
 
-        if(dir == floppy_dir_write) floppy_write_cmd(MT | MF | WRITE_DATA);
-        if(dir == floppy_dir_read) floppy_write_cmd(MT | MF | READ_DATA);
+        if(dir == floppy_dir_write) floppy_write_cmd(multitrack | MF | WRITE_DATA);
+        if(dir == floppy_dir_read) floppy_write_cmd(multitrack | MF | READ_DATA);
         floppy_write_cmd(dma.head << 2);    // 0:0:0:0:0:HD:US1:US0 = head and drive
         floppy_write_cmd(dma.cylinder);   // cylinder
         floppy_write_cmd(dma.head);  // first head (should match with above)
@@ -98,12 +107,16 @@ int floppy_transfer_pio(
         floppy_write_cmd(0x1b); // GAP3 length, 27 is default for 3.5"
         floppy_write_cmd(0xff); // data length (0xff if B/S != 0)
 
-        while((get_MSR() & 0x20) == 0x20){
-            // TODO - Add timeouts to conditions
-            while((get_MSR() & 0x80) != 0x80);
+        uint64_t deadline = timer_deadline(FLOPPY_IRQ_TIMEOUT_US);
+        while((get_MSR() & 0x20) == 0x20 && !timer_expired(deadline)){
+            while((get_MSR() & 0x80) != 0x80 && !timer_expired(deadline));
             while((get_MSR() & (RQM | NDMA)) == (RQM | NDMA))
                 callback();
         }
+        if((get_MSR() & 0x20) == 0x20){
+            error = E_FLOPPY_TIMEOUT;
+            continue;
+        }
 
         // first read status information
         unsigned char st0, st1, st2, rcy, rhe, rse, bps;
@@ -74,6 +74,21 @@ enum CommandBits {
     SK = 0x20,
 };
 
+// Longest waits for the controller before giving up
+#define FLOPPY_RQM_TIMEOUT_US      10000   // Controller ready for the next command or result byte
+#define FLOPPY_IRQ_TIMEOUT_US      3000000 // Seek, recalibration or transfer
+
+// Motor stays on this long after the last access so that the next one doesn't wait for it to spin up
+#define FLOPPY_MOTOR_IDLE_MS       2000
+// Time for a stopped motor to reach speed, 5.25" drives need longer than 3.5" ones
+#define FLOPPY_MOTOR_SPINUP_US     500000
+
+enum FloppyMotorState {
+    floppy_motor_off  = 0,
+    floppy_motor_on   = 1, // In use
+    floppy_motor_idle = 2, // Spinning, turned off by the timer once idle period passes
+};
+
 enum FloppyTransmitDirection {
     floppy_dir_read = 1,
     floppy_dir_write = 2,
@@ -88,14 +103,30 @@ enum FloppyType {
     F_2_88MB_3_5 = 5
 };
 
+#define FLOPPY_MAX_CYLINDER_SECTORS 72 // Both heads of a 2.88 MB disk
+
+// Cylinder of a drive kept in memory
+typedef struct {
+    int      valid;
+    uint16_t cylinder;
+    uint8_t* buffer; // Every sector of the cylinder, allocated on first use
+} FLOPPY_TRACK_CACHE;
+
 typedef struct{
     enum FloppyType type;
     uint8_t drive_number;
     uint16_t cylinders;
     uint16_t heads;
     uint16_t sectors_per_track;
+    FLOPPY_TRACK_CACHE cache;
 } FLOPPY_DEVICE;
 
+// Transfers of the selected mode (DMA or PIO), return 0 or error with E_ERROR set
+struct FloppyModeFunctions {
+    int (*read)(FLOPPY_DEVICE*, uint8_t*, uint32_t, uint32_t);
+    int (*write)(FLOPPY_DEVICE*, uint8_t*, uint32_t, uint32_t);
+};
+
 typedef struct DMA {
     uint16_t cylinder, head, sector;
 } DMA;
@@ -0,0 +1,46 @@
+#include "pci.h"
+#include "ports.h"
+
+static uint32_t config_address(PCI_ADDRESS* address, uint8_t offset);
+
+uint32_t pci_config_read(PCI_ADDRESS* address, uint8_t offset){
+    port_dword_out(PCI_CONFIG_ADDRESS, config_address(address, offset));
+    return port_dword_in(PCI_CONFIG_DATA);
+}
+
+void     pci_config_write(PCI_ADDRESS* address, uint8_t offset, uint32_t value){
+    port_dword_out(PCI_CONFIG_ADDRESS, config_address(address, offset));
+    port_dword_out(PCI_CONFIG_DATA, value);
+}
+
+int      pci_find_class(uint8_t class, uint8_t subclass, PCI_ADDRESS* address){
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            for (uint8_t function = 0; function < 8; function++) {
+                PCI_ADDRESS candidate = { (uint8_t)bus, slot, function, 0 };
+                if((pci_config_read(&candidate, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF){
+                    if(function == 0)
+                        break; // Nothing in the slot
+                    continue;
+                }
+
+                uint32_t class_register = pci_config_read(&candidate, PCI_CLASS);
+                if((class_register >> 24) == class && ((class_register >> 16) & 0xFF) == subclass){
+                    candidate.interface = (uint8_t)(class_register >> 8);
+                    *address = candidate;
+                    return 0;
+                }
+
+                // Only multi-function devices use functions past 0
+                if(function == 0 && !(pci_config_read(&candidate, PCI_HEADER_TYPE) & 0x00800000))
+                    break;
+            }
+        }
+    }
+    return 1;
+}
+
+static uint32_t config_address(PCI_ADDRESS* address, uint8_t offset){
+    return 0x80000000 | ((uint32_t)address->bus << 16) | ((uint32_t)(address->slot & 0x1F) << 11) |
+           ((uint32_t)(address->function & 0x07) << 8) | (offset & 0xFC);
+}
@@ -0,0 +1,36 @@
+#ifndef PCI_H_
+#define PCI_H_
+
+#include "../cpu/types.h"
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+enum PciConfigRegister { // Offsets in the configuration space
+    PCI_VENDOR_ID = 0x00,
+    PCI_COMMAND = 0x04,
+    PCI_CLASS = 0x08, // Revision, programming interface, subclass and class
+    PCI_HEADER_TYPE = 0x0C,
+    PCI_BAR0 = 0x10,
+    PCI_BAR4 = 0x20,
+};
+
+enum PciCommand {
+    PCI_COMMAND_IO_SPACE = 0x01,
+    PCI_COMMAND_MEMORY_SPACE = 0x02,
+    PCI_COMMAND_BUS_MASTER = 0x04,
+};
+
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint8_t interface; // Programming interface of the found class
+} PCI_ADDRESS;
+
+uint32_t pci_config_read(PCI_ADDRESS* address, uint8_t offset);
+void     pci_config_write(PCI_ADDRESS* address, uint8_t offset, uint32_t value);
+// Returns 0 and fills address for the first function of given class, 1 if there's none
+int      pci_find_class(uint8_t class, uint8_t subclass, PCI_ADDRESS* address);
+
+#endif // PCI_H_
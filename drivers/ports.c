@@ -32,4 +32,35 @@ unsigned short port_word_in (unsigned short port) {
 
 void port_word_out (unsigned short port, unsigned short data) {
     __asm__("out %%ax, %%dx" : : "a" (data), "d" (port));
-}
\ No newline at end of file
+}
+
+unsigned int port_dword_in (unsigned short port) {
+    unsigned int result;
+    __asm__("in %%dx, %%eax" : "=a" (result) : "d" (port));
+    return result;
+}
+
+void port_dword_out (unsigned short port, unsigned int data) {
+    __asm__("out %%eax, %%dx" : : "a" (data), "d" (port));
+}
+
+/**
+ * Block transfers between a port and memory, count is in units of the port width.
+ * 'rep ins'/'rep outs' move the whole block with a single instruction,
+ * edi/esi and ecx are updated by the CPU so they are marked as outputs too
+ */
+void port_words_in (unsigned short port, void* buffer, unsigned int count) {
+    __asm__ volatile("rep insw" : "+D" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+void port_words_out (unsigned short port, const void* buffer, unsigned int count) {
+    __asm__ volatile("rep outsw" : "+S" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+void port_dwords_in (unsigned short port, void* buffer, unsigned int count) {
+    __asm__ volatile("rep insl" : "+D" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+void port_dwords_out (unsigned short port, const void* buffer, unsigned int count) {
+    __asm__ volatile("rep outsl" : "+S" (buffer), "+c" (count) : "d" (port) : "memory");
+}
@@ -0,0 +1,339 @@
+#include "block_cache.h"
+#include "io_scheduler.h"
+
+#include "../libc/memory.h"
+#include "../kernel/util.h"
+
+typedef struct BLOCK_CACHE_ENTRY {
+    VFS_DEVICE* device;
+    uint32_t lba;
+    uint8_t  valid;
+    uint8_t  dirty;
+    uint8_t  referenced; // Second chance bit for CLOCK eviction
+    struct BLOCK_CACHE_ENTRY* next; // Next entry in the same hash bucket
+    uint8_t  buffer[512];
+} BLOCK_CACHE_ENTRY;
+
+static BLOCK_CACHE_ENTRY*  entries = 0;
+static BLOCK_CACHE_ENTRY*  buckets[BLOCK_CACHE_BUCKETS];
+static uint8_t*            run_buffer = 0; // Gathers neighbouring dirty sectors into one write
+static uint32_t            hand = 0;
+static int                 initialized = 0;
+static enum BLOCK_CACHE_POLICY policy = BLOCK_CACHE_WRITE_BACK;
+
+static int                 init_cache();
+static uint32_t            hash(VFS_DEVICE* device, uint32_t lba);
+static BLOCK_CACHE_ENTRY*  find_entry(VFS_DEVICE* device, uint32_t lba);
+static BLOCK_CACHE_ENTRY*  get_entry(VFS_DEVICE* device, uint32_t lba);
+static void                remove_entry(BLOCK_CACHE_ENTRY* entry);
+static enum E_DEVICE       write_back(BLOCK_CACHE_ENTRY* entry);
+static enum E_DEVICE       write_back_range(VFS_DEVICE* device, uint32_t sectors, uint32_t lba);
+static enum E_DEVICE       write_through(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba, int cache);
+static void                written_back(IO_REQUEST* request, enum E_DEVICE result);
+
+enum E_DEVICE block_cache_read(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
+    if(!init_cache())
+        return vfs_device_read_direct(device, buffer, sectors, lba);
+
+    if(sectors >= BLOCK_CACHE_BYPASS)
+        return block_cache_read_uncached(device, buffer, sectors, lba);
+
+    enum E_DEVICE result;
+    uint8_t* destination = buffer;
+    uint32_t i = 0;
+    while(i < sectors){
+        BLOCK_CACHE_ENTRY* entry = find_entry(device, lba + i);
+        if(entry){
+            k_memcpy(entry->buffer, &destination[i * 512], 512);
+            entry->referenced = 1;
+            i++;
+            continue;
+        }
+
+        // Read every missing sector in a row with a single request
+        uint32_t run = 1;
+        while(i + run < sectors && !find_entry(device, lba + i + run))
+            run++;
+        result = vfs_device_read_direct(device, &destination[i * 512], run, lba + i);
+        if(result != E_DEVICE_OK)
+            return result;
+        for (uint32_t j = 0; j < run; j++) {
+            entry = get_entry(device, lba + i + j);
+            if(entry)
+                k_memcpy(&destination[(i + j) * 512], entry->buffer, 512);
+        }
+        i += run;
+    }
+    return E_DEVICE_OK;
+}
+
+enum E_DEVICE block_cache_write(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
+    if(!init_cache())
+        return vfs_device_write_direct(device, buffer, sectors, lba);
+
+    // Bulk writes don't take entries either
+    if(sectors >= BLOCK_CACHE_BYPASS || policy == BLOCK_CACHE_WRITE_THROUGH)
+        return write_through(device, buffer, sectors, lba, sectors < BLOCK_CACHE_BYPASS);
+
+    uint8_t* source = buffer;
+    for (uint32_t i = 0; i < sectors; i++) {
+        BLOCK_CACHE_ENTRY* entry = get_entry(device, lba + i);
+        if(!entry){
+            // No room in cache, sector has to go to the device now
+            enum E_DEVICE result = vfs_device_write_direct(device, &source[i * 512], 1, lba + i);
+            if(result != E_DEVICE_OK)
+                return result;
+            continue;
+        }
+        k_memcpy(&source[i * 512], entry->buffer, 512);
+        entry->dirty = 1;
+        entry->referenced = 1;
+    }
+    return E_DEVICE_OK;
+}
+
+enum E_DEVICE block_cache_read_uncached(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
+    if(!initialized)
+        return vfs_device_read_direct(device, buffer, sectors, lba);
+
+    // Device only needs to see what wasn't written back yet
+    enum E_DEVICE result = write_back_range(device, sectors, lba);
+    if(result != E_DEVICE_OK)
+        return result;
+    return vfs_device_read_direct(device, buffer, sectors, lba);
+}
+
+enum E_DEVICE block_cache_write_uncached(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
+    if(!initialized)
+        return vfs_device_write_direct(device, buffer, sectors, lba);
+    return write_through(device, buffer, sectors, lba, 0);
+}
+
+enum E_DEVICE block_cache_prefetch(VFS_DEVICE* device, uint32_t sectors, uint32_t lba){
+    if(!init_cache())
+        return E_DEVICE_OK;
+
+    uint32_t i = 0;
+    while(i < sectors){
+        if(find_entry(device, lba + i)){
+            i++;
+            continue;
+        }
+
+        // Take over entries before reading, evicting them may use run_buffer for write back
+        uint32_t run = 0;
+        while(i + run < sectors && run < BLOCK_CACHE_BYPASS && !find_entry(device, lba + i + run)){
+            if(!get_entry(device, lba + i + run))
+                break;
+            run++;
+        }
+        if(run == 0)
+            return E_DEVICE_OK;
+
+        enum E_DEVICE result = vfs_device_read_direct(device, run_buffer, run, lba + i);
+        for (uint32_t j = 0; j < run; j++) {
+            // Entry might have been taken back while making room for the rest of the run
+            BLOCK_CACHE_ENTRY* entry = find_entry(device, lba + i + j);
+            if(!entry)
+                continue;
+            if(result != E_DEVICE_OK){
+                remove_entry(entry);
+                continue;
+            }
+            k_memcpy(&run_buffer[j * 512], entry->buffer, 512);
+        }
+        if(result != E_DEVICE_OK)
+            return result;
+        i += run;
+    }
+    return E_DEVICE_OK;
+}
+
+enum E_DEVICE block_cache_sync(VFS_DEVICE* device){
+    if(!initialized)
+        return E_DEVICE_OK;
+
+    // Scheduler sorts and merges dirty sectors, a queue that fills up is swept before more are added
+    enum E_DEVICE result = E_DEVICE_OK;
+    for (uint32_t i = 0; i < BLOCK_CACHE_ENTRIES && result == E_DEVICE_OK; i++) {
+        if(!entries[i].valid || !entries[i].dirty || (device && entries[i].device != device))
+            continue;
+        result = io_queue_add(vfs_device_get_queue(entries[i].device), IO_WRITE, entries[i].buffer, 1,
+                              entries[i].lba, written_back, &entries[i]);
+    }
+    for (uint32_t i = 0; i < BLOCK_CACHE_ENTRIES; i++) {
+        if(!entries[i].valid || !entries[i].dirty || (device && entries[i].device != device))
+            continue;
+        enum E_DEVICE run_result = io_queue_run(vfs_device_get_queue(entries[i].device));
+        if(result == E_DEVICE_OK)
+            result = run_result;
+    }
+    return result;
+}
+
+void          block_cache_invalidate(VFS_DEVICE* device){
+    if(!initialized)
+        return;
+    for (uint32_t i = 0; i < BLOCK_CACHE_ENTRIES; i++)
+        if(entries[i].valid && (!device || entries[i].device == device))
+            remove_entry(&entries[i]);
+}
+
+void          block_cache_set_policy(enum BLOCK_CACHE_POLICY new_policy){
+    // Nothing may stay dirty once writes go through
+    if(new_policy == BLOCK_CACHE_WRITE_THROUGH)
+        block_cache_sync(0);
+    policy = new_policy;
+}
+
+///
+/// Static helper functions
+///
+
+static int                 init_cache(){
+    if(initialized)
+        return 1;
+
+    // Allocated on first use, heap isn't ready when the kernel starts
+    entries = k_malloc(BLOCK_CACHE_ENTRIES * sizeof(BLOCK_CACHE_ENTRY));
+    run_buffer = k_malloc(BLOCK_CACHE_BYPASS * 512);
+    if(!entries || !run_buffer){
+        if(entries)
+            k_free(entries);
+        if(run_buffer)
+            k_free(run_buffer);
+        entries = 0;
+        run_buffer = 0;
+        return 0;
+    }
+    for (uint32_t i = 0; i < BLOCK_CACHE_ENTRIES; i++) {
+        entries[i].valid = 0;
+        entries[i].dirty = 0;
+        entries[i].referenced = 0;
+    }
+    for (uint32_t i = 0; i < BLOCK_CACHE_BUCKETS; i++)
+        buckets[i] = 0;
+    initialized = 1;
+    return 1;
+}
+
+static uint32_t            hash(VFS_DEVICE* device, uint32_t lba){
+    return (lba ^ ((uintptr_t)device >> 4)) % BLOCK_CACHE_BUCKETS;
+}
+
+static BLOCK_CACHE_ENTRY*  find_entry(VFS_DEVICE* device, uint32_t lba){
+    BLOCK_CACHE_ENTRY* entry = buckets[hash(device, lba)];
+    while(entry && (entry->device != device || entry->lba != lba))
+        entry = entry->next;
+    return entry;
+}
+
+// Returns entry for the sector, taking one over with CLOCK if it isn't cached. Contents are undefined if new
+static BLOCK_CACHE_ENTRY*  get_entry(VFS_DEVICE* device, uint32_t lba){
+    BLOCK_CACHE_ENTRY* entry = find_entry(device, lba);
+    if(entry){
+        entry->referenced = 1;
+        return entry;
+    }
+
+    // Find victim giving recently used entries a second chance
+    for (uint32_t i = 0; i < 2 * BLOCK_CACHE_ENTRIES; i++) {
+        BLOCK_CACHE_ENTRY* candidate = &entries[hand];
+        hand = (hand + 1) % BLOCK_CACHE_ENTRIES;
+        if(candidate->valid && candidate->referenced){
+            candidate->referenced = 0;
+            continue;
+        }
+        entry = candidate;
+        break;
+    }
+    if(!entry || write_back(entry) != E_DEVICE_OK)
+        return 0;
+    if(entry->valid)
+        remove_entry(entry);
+
+    // Link into the bucket
+    uint32_t bucket = hash(device, lba);
+    entry->device = device;
+    entry->lba = lba;
+    entry->valid = 1;
+    entry->dirty = 0;
+    entry->referenced = 1;
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+    return entry;
+}
+
+static void                remove_entry(BLOCK_CACHE_ENTRY* entry){
+    BLOCK_CACHE_ENTRY** link = &buckets[hash(entry->device, entry->lba)];
+    while(*link && *link != entry)
+        link = &(*link)->next;
+    if(*link)
+        *link = entry->next;
+    entry->valid = 0;
+    entry->dirty = 0;
+}
+
+static enum E_DEVICE       write_back(BLOCK_CACHE_ENTRY* entry){
+    if(!entry->valid || !entry->dirty)
+        return E_DEVICE_OK;
+
+    // Gather dirty neighbours so that they go to the device with one request
+    VFS_DEVICE* device = entry->device;
+    uint32_t first = entry->lba;
+    while(first > 0 && entry->lba - first < BLOCK_CACHE_BYPASS - 1){
+        BLOCK_CACHE_ENTRY* previous = find_entry(device, first - 1);
+        if(!previous || !previous->dirty)
+            break;
+        first--;
+    }
+    uint32_t count = 0;
+    while(count < BLOCK_CACHE_BYPASS){
+        BLOCK_CACHE_ENTRY* next = find_entry(device, first + count);
+        if(!next || !next->dirty)
+            break;
+        k_memcpy(next->buffer, &run_buffer[count * 512], 512);
+        count++;
+    }
+
+    enum E_DEVICE result = vfs_device_write_direct(device, run_buffer, count, first);
+    if(result != E_DEVICE_OK)
+        return result;
+    for (uint32_t i = 0; i < count; i++)
+        find_entry(device, first + i)->dirty = 0;
+    return E_DEVICE_OK;
+}
+
+static void                written_back(IO_REQUEST* request, enum E_DEVICE result){
+    if(result == E_DEVICE_OK)
+        ((BLOCK_CACHE_ENTRY*)request->data)->dirty = 0;
+}
+
+static enum E_DEVICE       write_back_range(VFS_DEVICE* device, uint32_t sectors, uint32_t lba){
+    for (uint32_t i = 0; i < sectors; i++) {
+        BLOCK_CACHE_ENTRY* entry = find_entry(device, lba + i);
+        if(!entry)
+            continue;
+        enum E_DEVICE result = write_back(entry);
+        if(result != E_DEVICE_OK)
+            return result;
+    }
+    return E_DEVICE_OK;
+}
+
+// Cached copies are updated and clean afterwards, missing ones are taken only if cache is set
+static enum E_DEVICE       write_through(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba, int cache){
+    enum E_DEVICE result = vfs_device_write_direct(device, buffer, sectors, lba);
+    if(result != E_DEVICE_OK)
+        return result;
+
+    uint8_t* source = buffer;
+    for (uint32_t i = 0; i < sectors; i++) {
+        BLOCK_CACHE_ENTRY* entry = cache ? get_entry(device, lba + i) : find_entry(device, lba + i);
+        if(!entry)
+            continue;
+        k_memcpy(&source[i * 512], entry->buffer, 512);
+        entry->dirty = 0;
+    }
+    return E_DEVICE_OK;
+}
@@ -0,0 +1,33 @@
+#ifndef BLOCK_CACHE_H_
+#define BLOCK_CACHE_H_
+
+#include "vfs.h"
+
+// Sectors kept in memory for all devices together
+#define BLOCK_CACHE_ENTRIES 256
+#define BLOCK_CACHE_BUCKETS 64
+// Requests at least this long go straight to the device so bulk transfers don't flush the cache
+#define BLOCK_CACHE_BYPASS  64
+
+enum BLOCK_CACHE_POLICY {
+    BLOCK_CACHE_WRITE_BACK    = 0,
+    BLOCK_CACHE_WRITE_THROUGH = 1,
+};
+
+// Sector sized cached versions of vfs_device_read_direct/vfs_device_write_direct
+enum E_DEVICE block_cache_read(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+enum E_DEVICE block_cache_write(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+// Don't take entries for sectors that aren't cached, for callers keeping the sectors in memory on their own.
+// Cached copies are kept coherent
+enum E_DEVICE block_cache_read_uncached(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+enum E_DEVICE block_cache_write_uncached(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+// Loads sectors that aren't cached yet, meant for reading ahead of sequential access
+enum E_DEVICE block_cache_prefetch(VFS_DEVICE* device, uint32_t sectors, uint32_t lba);
+
+// Writes back dirty sectors of a device, of every device if device is 0
+enum E_DEVICE block_cache_sync(VFS_DEVICE* device);
+// Drops every cached sector of a device without writing it back
+void          block_cache_invalidate(VFS_DEVICE* device);
+void          block_cache_set_policy(enum BLOCK_CACHE_POLICY policy);
+
+#endif // BLOCK_CACHE_H_
@@ -0,0 +1,1030 @@
+#include "fat12.h"
+
+#include <stdint.h>
+
+#include "../libc/memory.h"
+#include "vfs.h"
+#include "../kernel/util.h"
+#include "../libc/strings.h"
+
+static uint32_t max(uint32_t a, uint32_t b);
+static uint32_t min(uint32_t a, uint32_t b);
+
+// Partition initialization
+static FAT12_PARTITION* init_partition(VFS_DEVICE* device, FAT12_BOOT_RECORD* bootsector, uint8_t bits);
+
+// FAT buffer functions
+static uint32_t      read_fat_value(VFS_PARTITION *part, uint32_t cluster);
+static enum E_DEVICE write_fat_value(VFS_PARTITION *part, uint32_t cluster, uint32_t value);
+static enum E_DEVICE load_fat_byte(FAT12_PARTITION* partition, uint32_t offset, uint8_t* value);
+static enum E_DEVICE store_fat_byte(FAT12_PARTITION* partition, uint32_t offset, uint8_t value, uint8_t keep);
+static enum E_DEVICE flush_fat_buffer(VFS_PARTITION *part);
+static int           is_end_of_chain(FAT12_PARTITION* partition, uint32_t cluster);
+
+// FAT functions
+static uint32_t*     walk_chain(VFS_PARTITION *part, uint32_t cluster, uint32_t *length);
+static uint8_t*      read_chain(VFS_PARTITION *part, uint32_t cluster, uint32_t *length, uint32_t** clusters);
+static uint32_t*     reserve_chain(VFS_PARTITION *part, uint32_t* clusters, uint32_t end_of_chain);
+static uint32_t      resize_chain(VFS_PARTITION *part, FAT12_NODE_INFO* info, uint32_t clusters);
+static enum E_DEVICE delete_chain(VFS_PARTITION *part, uint32_t cluster);
+static int           load_chain(VFS_PARTITION *part, FAT12_NODE_INFO* info);
+
+// Cluster access routines
+static uint32_t      cluster_sector(FAT12_PARTITION* partition, uint32_t cluster);
+static enum E_DEVICE transfer_clusters(VFS_PARTITION *part, uint32_t* clusters, uint32_t count,
+                                       uint8_t* buffer, int write);
+static enum E_DEVICE read_part_cluster(VFS_PARTITION *part, uint32_t cluster, uint8_t *buffer,
+                                       uint32_t size, uint32_t offset);
+static enum E_DEVICE write_part_cluster(VFS_PARTITION *part, uint32_t cluster, uint8_t *buffer,
+                                        uint32_t size, uint32_t offset);
+
+// File access routines
+static int32_t transfer_bytes(VFS_PARTITION* partition, FAT12_NODE_INFO* info, uint8_t* buffer,
+                              uint32_t size, uint32_t offset, int write);
+static int32_t read_bytes_from_file(VFS_NODE* node, void* buffer, uint32_t size);
+static int32_t write_bytes_in_file(VFS_NODE* node, void* buffer, uint32_t size);
+
+// Directory access routines
+static struct FAT12_NODE* read_directory(VFS_PARTITION* partition, uint32_t cluster, uint32_t* entries,
+                                         uint32_t** clusters);
+static uint32_t        entry_sector(FAT12_PARTITION* partition, uint32_t* clusters, uint32_t entry);
+static FAT12_NODE_INFO find_node_in_directory(VFS_PARTITION* partition, char* filename,
+                                              FAT12_NODE_INFO* directory, int is_creating);
+static enum E_DEVICE   save_descriptor(VFS_PARTITION* partition, FAT12_NODE_INFO* node_info);
+static int             is_created(FAT12_NODE_INFO* node_info);
+static int             initialize_node(VFS_PARTITION *partition, FAT12_NODE_INFO *node_info,
+                                       char *filename, uint32_t filename_length, int flags);
+static int             initialize_directory_inside(VFS_PARTITION *partition, FAT12_NODE_INFO *node_info,
+                                                   struct FAT12_NODE* node);
+static void            free_node_info(FAT12_NODE_INFO* node_info);
+static DIR_ENTRY       fat12_entry_to_dir_entry(struct FAT12_NODE* node);
+
+// Path resolving
+static void             make_8point3_name(const char* filename, uint32_t filename_length, char* buffer);
+static FAT12_NODE_INFO* resolve_path(const char *path, VFS_PARTITION *partition, FAT12_NODE_INFO *fat12_node, int flags);
+static char*            get_filename_from_path(const char* path, uint32_t* length);
+
+enum E_PARTITION fat12_find_partition(VFS_DEVICE *device, enum PARTITION_FORMAT formats){
+
+    FAT12_BOOT_RECORD info = {};
+
+    if(vfs_device_read(device, &info.buffer[0], 1, 0) != E_DEVICE_OK)
+        return E_PARTITION_DEVICE_FAILED;
+    if(info.ebr.signature != 0x28 && info.ebr.signature != 0x29)
+        return E_PARTITION_NO_FILESYSTEM_DETECTED;
+    // FAT32 leaves these 0, its boot code could pass for FAT12/16 signature
+    if(info.bpb.sectors_per_fat == 0 || info.bpb.directory_entries == 0)
+        return E_PARTITION_NO_FILESYSTEM_DETECTED;
+    if(info.bpb.bytes_per_sector != 512 || info.bpb.sectors_per_cluster == 0 || info.bpb.fats == 0)
+        return E_PARTITION_NO_FILESYSTEM_DETECTED;
+    if(info.ebr.boot_signature != 0xAA55)
+        return E_PARTITINO_INVALID_SIGNATURE;
+
+    // Type is decided only by the count of data clusters
+    uint32_t sectors = info.bpb.sectors_in_volume != 0 ?
+        info.bpb.sectors_in_volume : info.bpb.large_sectors_count;
+    uint32_t data_offset = info.bpb.reserved_sectors + info.bpb.fats * info.bpb.sectors_per_fat +
+                           (info.bpb.directory_entries * 32 + 511) / 512;
+    if(sectors <= data_offset)
+        return E_PARTITION_NO_FILESYSTEM_DETECTED;
+    uint32_t data_clusters = (sectors - data_offset) / info.bpb.sectors_per_cluster;
+    if(data_clusters >= FAT16_MAX_CLUSTERS)
+        return E_PARTITION_NO_FILESYSTEM_DETECTED;
+    uint8_t bits = data_clusters < FAT12_MAX_CLUSTERS ? 12 : 16;
+    if(!(formats & (bits == 12 ? PARTITION_FORMAT_FAT12 : PARTITION_FORMAT_FAT16)))
+        return E_PARTITION_NO_FILESYSTEM_DETECTED;
+
+    FAT12_PARTITION* fat_partition = init_partition(device, &info, bits);
+    if(!fat_partition)
+        return E_PARTITION_DEVICE_FAILED;
+    VFS_PARTITION* _ = 0;
+    vfs_register_partition(fat_partition, device, fat12_open_file, fat12_create_file,
+                           fat12_remove_file, fat12_open_dir, fat12_make_dir, fat12_remove_dir, fat12_sync, _);
+    return E_PARTITION_OK;
+}
+
+static FAT12_PARTITION* init_partition(VFS_DEVICE* device, FAT12_BOOT_RECORD* bootsector, uint8_t bits){
+    FAT12_PARTITION* partition = k_malloc(sizeof(FAT12_PARTITION));
+    if(!partition)
+        return 0;
+
+    partition->bits = bits;
+    partition->sectors_per_cluster = bootsector->bpb.sectors_per_cluster;
+    partition->reserved_sectors = bootsector->bpb.reserved_sectors;
+    partition->FATs = bootsector->bpb.fats;
+    partition->root_entries = bootsector->bpb.directory_entries;
+    partition->sectors = bootsector->bpb.sectors_in_volume != 0 ?
+        bootsector->bpb.sectors_in_volume : bootsector->bpb.large_sectors_count;
+    partition->sectors_per_fat = bootsector->bpb.sectors_per_fat;
+    partition->hidden_sectors = bootsector->bpb.hidden_sectors;
+
+    partition->fat_offset  = bootsector->bpb.reserved_sectors;
+    partition->root_offset = partition->reserved_sectors + partition->FATs * partition->sectors_per_fat;
+    partition->root_size   = ((partition->root_entries * 32) + 511) / 512;
+    partition->data_offset = partition->root_offset + partition->root_size;
+
+    // Count of clusters is limited both by size of volume and size of FAT
+    partition->clusters = min((partition->sectors - partition->data_offset) / partition->sectors_per_cluster + 2,
+                              partition->sectors_per_fat * 512 * 8 / bits);
+    partition->search_start = 2;
+    partition->end_of_chain = bits == 12 ? 0xFFF : 0xFFFF;
+
+    partition->cluster_size = partition->sectors_per_cluster * 512;
+    partition->cluster_buffer = k_malloc(partition->cluster_size);
+    if(!partition->cluster_buffer ||
+       fat_cache_init(&partition->fat_cache, device, partition->fat_offset, partition->sectors_per_fat,
+                      partition->FATs, 0, 1, FAT_CACHE_DEFAULT_ENTRIES) != E_DEVICE_OK){
+        if(partition->cluster_buffer)
+            k_free(partition->cluster_buffer);
+        k_free(partition);
+        return 0;
+    }
+
+    k_memcpy(&bootsector->ebr.volume_label_string, &partition->label, 11);
+
+    return partition;
+}
+
+VFS_NODE*            fat12_open_file(VFS_PARTITION *partition, VFS_NODE* dir,
+                                     char* path, int flags){
+    FAT12_NODE_INFO* node_info = resolve_path(path, partition, vfs_node_get_data(dir), flags);
+    if(!node_info)
+        return 0;
+
+    if(flags & O_CREAT && is_created(node_info)) {
+        uint32_t length;
+        char* filename = get_filename_from_path(path, &length);
+        initialize_node(partition, node_info, filename, length, 0);
+    }
+
+    // Cannot open directory with this call, nor entry that couldn't be created
+    if(node_info->node.attributes & FAT12_DA_DIR || is_created(node_info)){
+        free_node_info(node_info);
+        return 0;
+    }
+
+    VFS_NODE* file_descriptor;
+    vfs_file_create_descriptor(node_info, partition, fat12_write_file, fat12_read_file, fat12_lseek,
+                               fat12_allocate_file, 0, &file_descriptor);
+
+    return file_descriptor;
+}
+
+int                  fat12_create_file(VFS_PARTITION *partition, VFS_NODE* dir,
+                                       char* path, int flags){
+    FAT12_NODE_INFO* node_info = resolve_path(path, partition, vfs_node_get_data(dir), flags | O_CREAT);
+    if(!node_info)
+        return 1;
+
+    if(is_created(node_info)) {
+        uint32_t length;
+        char* filename = get_filename_from_path(path, &length);
+        initialize_node(partition, node_info, filename, length, 0);
+    }
+    int result = is_created(node_info) || (node_info->node.attributes & FAT12_DA_DIR);
+    free_node_info(node_info);
+    return result;
+}
+
+int                  fat12_remove_file(VFS_PARTITION *partition, VFS_NODE* dir,
+                                       char* path){
+    FAT12_NODE_INFO* node_info = resolve_path(path, partition, vfs_node_get_data(dir), 0);
+    if(!node_info)
+        return 1;
+    if(node_info->node.attributes & FAT12_DA_DIR) {
+        free_node_info(node_info);
+        return 1;
+    }
+
+    // Entry goes first so that a failure never leaves it pointing at free clusters
+    node_info->node.filename[0] = (int8_t)0xE5;
+    int result = save_descriptor(partition, node_info) != E_DEVICE_OK ||
+                 delete_chain(partition, node_info->node.start_low) != E_DEVICE_OK;
+    free_node_info(node_info);
+    return result;
+}
+
+VFS_NODE*            fat12_open_dir(VFS_PARTITION *partition, VFS_NODE* dir,
+                                    char* path){
+    FAT12_NODE_INFO* node_info = resolve_path(path, partition, vfs_node_get_data(dir), 0);
+    if(!node_info)
+        return 0;
+    if(!(node_info->node.attributes & FAT12_DA_DIR)){
+        free_node_info(node_info);
+        return 0;
+    }
+
+    VFS_NODE* file_descriptor;
+    vfs_file_create_descriptor(node_info, partition, 0, 0, 0, 0, fat12_list_dir, &file_descriptor);
+
+    return file_descriptor;
+}
+
+int                  fat12_make_dir(VFS_PARTITION *partition, VFS_NODE* dir,
+                                    char* path){
+    FAT12_NODE_INFO* node_info = resolve_path(path, partition, vfs_node_get_data(dir), O_CREAT);
+    if(!node_info)
+        return 1;
+    if(is_created(node_info)) {
+        uint32_t length;
+        char* filename = get_filename_from_path(path, &length);
+        initialize_node(partition, node_info, filename, length, O_DIR);
+    }
+    int result = is_created(node_info) || !(node_info->node.attributes & FAT12_DA_DIR);
+    free_node_info(node_info);
+
+    return result;
+}
+
+int                  fat12_remove_dir(VFS_PARTITION *partition, VFS_NODE* dir,
+                                      char* path){
+    FAT12_NODE_INFO* node_info = resolve_path(path, partition, vfs_node_get_data(dir), 0);
+    if(!node_info)
+        return 1;
+
+    // Root directory and "." or ".." entries can't be removed
+    int result = !(node_info->node.attributes & FAT12_DA_DIR) || node_info->descriptor_sector == 0 ||
+                 node_info->node.filename[0] == '.';
+
+    // Only "." and ".." may be left inside
+    uint32_t entries = 0;
+    struct FAT12_NODE* directory = result ? 0 : read_directory(partition, node_info->node.start_low, &entries, 0);
+    if(!result && !directory)
+        result = 1;
+    for (uint32_t i = 0; i < entries && !result; i++) {
+        if(directory[i].filename[0] == '\0')
+            break;
+        result = (uint8_t)directory[i].filename[0] != 0xE5 && directory[i].filename[0] != '.';
+    }
+    if(directory)
+        k_free(directory);
+
+    if(!result){
+        node_info->node.filename[0] = (int8_t)0xE5;
+        result = save_descriptor(partition, node_info) != E_DEVICE_OK ||
+                 delete_chain(partition, node_info->node.start_low) != E_DEVICE_OK;
+    }
+    free_node_info(node_info);
+    return result;
+}
+
+static uint32_t max(uint32_t a, uint32_t b){
+    return (a > b) ? a : b;
+}
+
+static uint32_t min(uint32_t a, uint32_t b){
+    return (a > b) ? b : a;
+}
+
+int                  fat12_sync(VFS_PARTITION* partition){
+    if(!vfs_partition_get_data(partition))
+        return 1;
+    return flush_fat_buffer(partition) != E_DEVICE_OK;
+}
+
+int                  fat12_write_file (VFS_NODE* node, void* buffer, uint32_t size){
+    int32_t bytes_written = write_bytes_in_file(node, buffer, size);
+    vfs_node_move_offset(node, bytes_written);
+
+    return bytes_written;
+}
+
+int                  fat12_read_file  (VFS_NODE* node, void* buffer, uint32_t size){
+    int32_t bytes_read = read_bytes_from_file(node, buffer, size);
+    vfs_node_move_offset(node, bytes_read);
+
+    return bytes_read;
+}
+
+int                  fat12_lseek(VFS_NODE* node, int32_t offset, enum SEEK whence) {
+    if(!node)
+        return -E_LSEEK_BADF;
+    // Calculate new absolute position
+    int32_t position;
+    if(whence == SEEK_SET){
+        position = offset;
+    } else if(whence == SEEK_CUR){
+        position = vfs_node_get_offset(node) + offset;
+    } else if(whence == SEEK_END){
+        FAT12_NODE_INFO* info = vfs_node_get_data(node);
+        position = (int32_t)info->node.size + offset;
+    }else {
+        return -E_LSEEK_INVAL;
+    }
+    if(position < 0)
+        return -E_LSEEK_INVAL;
+
+    return vfs_node_move_offset(node, position - vfs_node_get_offset(node));
+}
+
+int                  fat12_allocate_file(VFS_NODE* node, uint32_t size){
+    FAT12_NODE_INFO* info = vfs_node_get_data(node);
+    VFS_PARTITION* partition = vfs_node_get_partition(node);
+    FAT12_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    if(!info)
+        return -1;
+
+    uint32_t needed = max((size + fat_partition->cluster_size - 1) / fat_partition->cluster_size, 1);
+    if(resize_chain(partition, info, needed) < needed)
+        return -1;
+
+    // Space the file grows by reads as zeroes
+    if(size > info->node.size){
+        uint32_t grow = size - info->node.size;
+        if(transfer_bytes(partition, info, 0, grow, info->node.size, 1) != (int32_t)grow)
+            return -1;
+        info->node.size = size;
+    }
+    if(flush_fat_buffer(partition) != E_DEVICE_OK)
+        return -1;
+    if(save_descriptor(partition, info) != E_DEVICE_OK)
+        return -1;
+    return 0;
+}
+
+int                  fat12_list_dir   (VFS_NODE* node, DIR_ENTRY* buffer, uint32_t size){
+    FAT12_NODE_INFO* info = vfs_node_get_data(node);
+    VFS_PARTITION* partition = vfs_node_get_partition(node);
+
+    // Whole directory is read at once, with one request per run of adjacent clusters
+    uint32_t entries;
+    struct FAT12_NODE* fat12_entries = read_directory(partition, info->node.start_low, &entries, 0);
+    if(!fat12_entries)
+        return -1;
+
+    uint32_t entries_read = 0;
+    for (uint32_t i = 0; i < entries && entries_read < size; i++) {
+        if(fat12_entries[i].filename[0] == '\0')
+            break; // End of directory
+        // Deleted entries, volume label and long name parts
+        if((uint8_t)fat12_entries[i].filename[0] == 0xE5 || (fat12_entries[i].attributes & FAT12_DA_VOLUME_ID))
+            continue;
+        buffer[entries_read++] = fat12_entry_to_dir_entry(&fat12_entries[i]);
+    }
+
+    k_free(fat12_entries);
+    return (int)entries_read;
+}
+
+///
+/// Static helper functions
+///
+
+static DIR_ENTRY fat12_entry_to_dir_entry(struct FAT12_NODE* node) {
+    DIR_ENTRY entry;
+    k_memcpy(node->filename, entry.name, 11);
+    entry.name[11] = '\0';
+    entry.type = (node->attributes & FAT12_DA_DIR) ? DIRECTORY : FILE;
+    entry.size = node->size;
+    return entry;
+}
+
+static int32_t read_bytes_from_file(VFS_NODE* node, void* buffer, uint32_t size) {
+    FAT12_NODE_INFO* info = vfs_node_get_data(node);
+    VFS_PARTITION* partition = vfs_node_get_partition(node);
+    uint32_t offset = vfs_node_get_offset(node);
+
+    if(offset >= info->node.size)
+        return 0;
+    size = min(size, info->node.size - offset);
+    return transfer_bytes(partition, info, buffer, size, offset, 0);
+}
+
+static int32_t write_bytes_in_file(VFS_NODE* node, void* buffer, uint32_t size) {
+    FAT12_NODE_INFO* info = vfs_node_get_data(node);
+    VFS_PARTITION* partition = vfs_node_get_partition(node);
+    FAT12_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    uint32_t offset = vfs_node_get_offset(node);
+    if(size == 0)
+        return 0;
+
+    // Reserve everything missing at once so that the new clusters are allocated next to each other
+    resize_chain(partition, info, (offset + size + fat_partition->cluster_size - 1) / fat_partition->cluster_size);
+
+    // Writing past the end leaves a gap which must not show old contents of the clusters
+    if(offset > info->node.size)
+        info->node.size += transfer_bytes(partition, info, 0, offset - info->node.size, info->node.size, 1);
+    int32_t bytes_written = 0;
+    if(offset <= info->node.size)
+        bytes_written = transfer_bytes(partition, info, buffer, size, offset, 1);
+
+    info->node.size = max(info->node.size, offset + bytes_written);
+    flush_fat_buffer(partition);
+    save_descriptor(partition, info);
+
+    return bytes_written;
+}
+
+// Moves bytes between buffer and file, whole clusters lying one after another go with one request.
+// Writing with buffer 0 fills the range with zeroes
+static int32_t transfer_bytes(VFS_PARTITION* partition, FAT12_NODE_INFO* info, uint8_t* buffer,
+                              uint32_t size, uint32_t offset, int write) {
+    FAT12_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    uint32_t cluster_size = fat_partition->cluster_size;
+
+    // Find cluster containing the offset
+    uint32_t file_cluster = offset / cluster_size;
+    offset %= cluster_size;
+
+    int32_t bytes_done = 0;
+    while(size > 0){
+        // Chain might have been extended through another descriptor of the same file
+        if(file_cluster >= info->chain_length && (load_chain(partition, info) || file_cluster >= info->chain_length))
+            break;
+
+        uint32_t clusters = offset == 0 && buffer ? min(size / cluster_size, info->chain_length - file_cluster) : 0;
+        uint32_t bytes;
+        enum E_DEVICE result;
+        if(clusters){
+            bytes = clusters * cluster_size;
+            result = transfer_clusters(partition, &info->chain[file_cluster], clusters, &buffer[bytes_done], write);
+        }else {
+            clusters = 1;
+            bytes = min(size, cluster_size - offset);
+            uint8_t* part = buffer ? &buffer[bytes_done] : 0;
+            result = write ? write_part_cluster(partition, info->chain[file_cluster], part, bytes, offset) :
+                             read_part_cluster(partition, info->chain[file_cluster], part, bytes, offset);
+        }
+        if(result != E_DEVICE_OK)
+            break;
+        file_cluster += clusters;
+        bytes_done += (int32_t)bytes;
+        offset = 0;
+        size -= bytes;
+    }
+    return bytes_done;
+}
+
+static uint32_t      cluster_sector(FAT12_PARTITION* partition, uint32_t cluster){
+    return partition->data_offset + (cluster - 2) * partition->sectors_per_cluster;
+}
+
+// Transfers clusters from the list to or from consecutive parts of buffer, one request per run of adjacent ones
+static enum E_DEVICE transfer_clusters(VFS_PARTITION *part, uint32_t* clusters, uint32_t count,
+                                       uint8_t* buffer, int write){
+    FAT12_PARTITION* partition = vfs_partition_get_data(part);
+    VFS_DEVICE* device = vfs_partition_get_device(part);
+    uint32_t i = 0;
+    while(i < count){
+        uint32_t run = 1;
+        while(i + run < count && clusters[i + run] == clusters[i] + run)
+            run++;
+
+        uint8_t* run_buffer = &buffer[i * partition->cluster_size];
+        uint32_t sectors = run * partition->sectors_per_cluster;
+        enum E_DEVICE result = write ?
+            vfs_device_write(device, run_buffer, sectors, cluster_sector(partition, clusters[i])) :
+            vfs_device_read(device, run_buffer, sectors, cluster_sector(partition, clusters[i]));
+        if(result != E_DEVICE_OK)
+            return result;
+        i += run;
+    }
+    return E_DEVICE_OK;
+}
+
+static enum E_DEVICE read_part_cluster(VFS_PARTITION *part, uint32_t cluster, uint8_t *buffer,
+                                       uint32_t size, uint32_t offset){
+    FAT12_PARTITION* partition = vfs_partition_get_data(part);
+    VFS_DEVICE* device = vfs_partition_get_device(part);
+
+    // Read only sectors covering requested bytes
+    uint32_t first = offset / 512;
+    uint32_t count = (offset + size + 511) / 512 - first;
+    uint8_t* temp_buffer = partition->cluster_buffer;
+    enum E_DEVICE result = vfs_device_read(device, temp_buffer, count, cluster_sector(partition, cluster) + first);
+    if(result != E_DEVICE_OK)
+        return result;
+    k_memcpy(&temp_buffer[offset % 512], buffer, size);
+    return E_DEVICE_OK;
+}
+
+// Buffer 0 writes zeroes
+static enum E_DEVICE write_part_cluster(VFS_PARTITION *part, uint32_t cluster, uint8_t *buffer,
+                                        uint32_t size, uint32_t offset){
+    FAT12_PARTITION* partition = vfs_partition_get_data(part);
+    VFS_DEVICE* device = vfs_partition_get_device(part);
+    uint32_t lba = cluster_sector(partition, cluster);
+
+    // Only partially covered head and tail sectors have to be read first
+    uint32_t first = offset / 512;
+    uint32_t count = (offset + size + 511) / 512 - first;
+    uint32_t end = (offset % 512) + size;
+    uint8_t* temp_buffer = partition->cluster_buffer;
+    enum E_DEVICE result;
+    if(offset % 512 != 0 || (count == 1 && end % 512 != 0)){
+        result = vfs_device_read(device, temp_buffer, 1, lba + first);
+        if(result != E_DEVICE_OK)
+            return result;
+    }
+    if(count > 1 && end % 512 != 0){
+        result = vfs_device_read(device, temp_buffer + (count - 1) * 512, 1, lba + first + count - 1);
+        if(result != E_DEVICE_OK)
+            return result;
+    }
+    if(buffer)
+        k_memcpy(buffer, temp_buffer + offset % 512, size);
+    else
+        k_memset(temp_buffer + offset % 512, size, 0);
+    return vfs_device_write(device, temp_buffer, count, lba + first);
+}
+
+///
+/// FAT
+///
+
+static int           is_end_of_chain(FAT12_PARTITION* partition, uint32_t cluster){
+    // Covers end of chain markers, bad clusters and damaged entries pointing outside of the volume
+    return cluster < 2 || cluster >= partition->clusters;
+}
+
+// Failure reads as end of chain, so that a chain is cut short rather than a used cluster taken as free
+static uint32_t      read_fat_value(VFS_PARTITION *part, uint32_t cluster){
+    FAT12_PARTITION* partition = vfs_partition_get_data(part);
+
+    // FAT12 entry takes one and a half byte and might be split between two sectors
+    uint32_t offset = partition->bits == 12 ? cluster + cluster / 2 : cluster * 2;
+    uint8_t low, high;
+    if(load_fat_byte(partition, offset, &low) != E_DEVICE_OK ||
+       load_fat_byte(partition, offset + 1, &high) != E_DEVICE_OK)
+        return partition->end_of_chain;
+
+    uint32_t value = low | (high << 8);
+    if(partition->bits == 16)
+        return value;
+    return cluster & 1 ? value >> 4 : value & 0x0FFF;
+}
+
+static enum E_DEVICE write_fat_value(VFS_PARTITION *part, uint32_t cluster, uint32_t value){
+    FAT12_PARTITION* partition = vfs_partition_get_data(part);
+
+    // Nibbles belonging to the neighbouring FAT12 entry are kept
+    uint32_t offset = partition->bits == 12 ? cluster + cluster / 2 : cluster * 2;
+    uint8_t keep_low = 0, keep_high = 0;
+    if(partition->bits == 12){
+        value &= 0x0FFF;
+        if(cluster & 1){
+            value <<= 4;
+            keep_low = 0x0F;
+        }else
+            keep_high = 0xF0;
+    }
+
+    enum E_DEVICE result = store_fat_byte(partition, offset, value & 0xFF, keep_low);
+    if(result != E_DEVICE_OK)
+        return result;
+    return store_fat_byte(partition, offset + 1, (value >> 8) & 0xFF, keep_high);
+}
+
+static enum E_DEVICE load_fat_byte(FAT12_PARTITION* partition, uint32_t offset, uint8_t* value){
+    uint8_t* fat;
+    enum E_DEVICE result = fat_cache_load(&partition->fat_cache, offset / 512, &fat);
+    if(result != E_DEVICE_OK)
+        return result;
+    *value = fat[offset % 512];
+    return E_DEVICE_OK;
+}
+
+static enum E_DEVICE store_fat_byte(FAT12_PARTITION* partition, uint32_t offset, uint8_t value, uint8_t keep){
+    uint8_t* fat;
+    enum E_DEVICE result = fat_cache_load(&partition->fat_cache, offset / 512, &fat);
+    if(result != E_DEVICE_OK)
+        return result;
+    fat[offset % 512] = (fat[offset % 512] & keep) | value;
+    fat_cache_set_changed(&partition->fat_cache, offset / 512);
+    return E_DEVICE_OK;
+}
+
+// Writes changed FAT sectors and copies them to the other FATs
+static enum E_DEVICE flush_fat_buffer(VFS_PARTITION *part){
+    FAT12_PARTITION* partition = vfs_partition_get_data(part);
+    enum E_DEVICE result = fat_cache_flush(&partition->fat_cache);
+    if(result != E_DEVICE_OK)
+        return result;
+    return fat_cache_mirror(&partition->fat_cache);
+}
+
+// Returns clusters of the chain starting at cluster, 0 if it is empty
+static uint32_t*     walk_chain(VFS_PARTITION *part, uint32_t cluster, uint32_t *length){
+    FAT12_PARTITION* partition = vfs_partition_get_data(part);
+    uint32_t* clusters_list = 0;
+    uint32_t capacity = 0;
+
+    // Chain can't be longer than the volume, loops in a damaged FAT end there
+    *length = 0;
+    while(!is_end_of_chain(partition, cluster) && *length < partition->clusters){
+        if(*length == capacity){
+            capacity = capacity ? capacity * 2 : 16;
+            uint32_t* grown = k_realloc(clusters_list, capacity * sizeof(uint32_t));
+            if(!grown){
+                k_free(clusters_list);
+                *length = 0;
+                return 0;
+            }
+            clusters_list = grown;
+        }
+        clusters_list[(*length)++] = cluster;
+        cluster = read_fat_value(part, cluster);
+    }
+    return clusters_list;
+}
+
+// Reads whole chain into a new buffer. Clusters lying one after another are read with one request
+static uint8_t*      read_chain(VFS_PARTITION *part, uint32_t cluster, uint32_t *length, uint32_t** clusters){
+    FAT12_PARTITION* partition = vfs_partition_get_data(part);
+    uint32_t* clusters_list = walk_chain(part, cluster, length);
+    if(!clusters_list)
+        return 0;
+
+    uint8_t* buffer = k_malloc(*length * partition->cluster_size);
+    if(!buffer || transfer_clusters(part, clusters_list, *length, buffer, 0) != E_DEVICE_OK){
+        if(buffer)
+            k_free(buffer);
+        k_free(clusters_list);
+        return 0;
+    }
+
+    if(clusters)
+        *clusters = clusters_list;
+    else
+        k_free(clusters_list);
+    return buffer;
+}
+
+// Links up to clusters free clusters into a chain appended to end_of_chain (new one if it is 0),
+// returns them in order and sets clusters to how many there are. Returns 0 if volume is full
+static uint32_t*     reserve_chain(VFS_PARTITION *part, uint32_t* clusters, uint32_t end_of_chain){
+    FAT12_PARTITION* partition = vfs_partition_get_data(part);
+    uint32_t* clusters_list = k_malloc(*clusters * sizeof(uint32_t));
+    if(!clusters_list)
+        return 0;
+
+    // Search continues after the last allocation, so clusters written one after another stay adjacent
+    uint32_t found = 0;
+    uint32_t cluster = partition->search_start;
+    for (uint32_t checked = 2; checked < partition->clusters && found < *clusters; checked++) {
+        if(cluster >= partition->clusters)
+            cluster = 2;
+        if(read_fat_value(part, cluster) == 0)
+            clusters_list[found++] = cluster;
+        cluster++;
+    }
+    if(found == 0){
+        k_free(clusters_list);
+        return 0;
+    }
+
+    // New chain is terminated before it is linked, so it is never left open
+    enum E_DEVICE result = E_DEVICE_OK;
+    for (uint32_t i = 0; i < found && result == E_DEVICE_OK; i++)
+        result = write_fat_value(part, clusters_list[i],
+                                 i + 1 < found ? clusters_list[i + 1] : partition->end_of_chain);
+    if(result == E_DEVICE_OK && end_of_chain)
+        result = write_fat_value(part, end_of_chain, clusters_list[0]);
+    if(result != E_DEVICE_OK){
+        k_free(clusters_list);
+        return 0;
+    }
+    partition->search_start = clusters_list[found - 1] + 1;
+    *clusters = found;
+    return clusters_list;
+}
+
+// Makes chain of the node at least clusters long, returns how many clusters it has
+static uint32_t      resize_chain(VFS_PARTITION *part, FAT12_NODE_INFO* info, uint32_t clusters){
+    // Chain might have grown through another descriptor since it was read
+    if(info->chain_length < clusters && load_chain(part, info))
+        return 0;
+    if(info->chain_length >= clusters)
+        return info->chain_length;
+
+    uint32_t* chain = k_realloc(info->chain, clusters * sizeof(uint32_t));
+    if(!chain)
+        return info->chain_length;
+    info->chain = chain;
+
+    // Volume running out of space leaves the chain shorter
+    uint32_t last = info->chain_length ? chain[info->chain_length - 1] : 0;
+    uint32_t count = clusters - info->chain_length;
+    uint32_t* added = reserve_chain(part, &count, last);
+    if(!added)
+        return info->chain_length;
+    k_memcpy(added, &chain[info->chain_length], count * sizeof(uint32_t));
+    k_free(added);
+
+    // Node had no clusters yet
+    if(last == 0){
+        info->node.start_low = chain[0];
+        save_descriptor(part, info);
+    }
+    info->chain_length += count;
+    return info->chain_length;
+}
+
+// Reads chain of the node again, returns non 0 if it couldn't be done
+static int           load_chain(VFS_PARTITION *part, FAT12_NODE_INFO* info){
+    if(info->chain)
+        k_free(info->chain);
+    info->chain = walk_chain(part, info->node.start_low, &info->chain_length);
+    return !info->chain && !is_end_of_chain(vfs_partition_get_data(part), info->node.start_low);
+}
+
+static enum E_DEVICE delete_chain(VFS_PARTITION *part, uint32_t cluster){
+    FAT12_PARTITION* partition = vfs_partition_get_data(part);
+    for (uint32_t i = 0; !is_end_of_chain(partition, cluster) && i < partition->clusters; i++) {
+        uint32_t next = read_fat_value(part, cluster);
+        enum E_DEVICE result = write_fat_value(part, cluster, 0);
+        if(result != E_DEVICE_OK)
+            return result;
+        cluster = next;
+    }
+
+    // Freed clusters are preferred by the next allocation
+    return flush_fat_buffer(part);
+}
+
+///
+/// Directories
+///
+
+// Returns entries of the directory, root directory if cluster is 0
+static struct FAT12_NODE* read_directory(VFS_PARTITION* partition, uint32_t cluster, uint32_t* entries,
+                                         uint32_t** clusters){
+    FAT12_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    if(clusters)
+        *clusters = 0;
+
+    // Root directory lies in a fixed region before data clusters
+    if(cluster == 0){
+        struct FAT12_NODE* buffer = k_malloc(fat_partition->root_size * 512);
+        if(!buffer)
+            return 0;
+        if(vfs_device_read(vfs_partition_get_device(partition), buffer, fat_partition->root_size,
+                           fat_partition->root_offset) != E_DEVICE_OK){
+            k_free(buffer);
+            return 0;
+        }
+        *entries = fat_partition->root_entries;
+        return buffer;
+    }
+
+    uint32_t length;
+    struct FAT12_NODE* buffer = (struct FAT12_NODE*)read_chain(partition, cluster, &length, clusters);
+    *entries = buffer ? length * fat_partition->cluster_size / sizeof(struct FAT12_NODE) : 0;
+    return buffer;
+}
+
+// Sector holding the entry of directory read by read_directory
+static uint32_t        entry_sector(FAT12_PARTITION* partition, uint32_t* clusters, uint32_t entry){
+    if(!clusters)
+        return partition->root_offset + entry / 16;
+    uint32_t entries_per_cluster = partition->cluster_size / sizeof(struct FAT12_NODE);
+    return cluster_sector(partition, clusters[entry / entries_per_cluster]) + (entry % entries_per_cluster) / 16;
+}
+
+static FAT12_NODE_INFO find_node_in_directory(VFS_PARTITION* partition, char* filename,
+                                              FAT12_NODE_INFO* directory, int is_creating) {
+    FAT12_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    FAT12_NODE_INFO result = {.descriptor_sector = 0};
+
+    // Prepare 8.3 name for comparing
+    char name83[11];
+    make_8point3_name(filename, str_len(filename), name83);
+
+    uint32_t directory_cluster = directory->node.start_low;
+    uint32_t entries;
+    uint32_t* clusters;
+    struct FAT12_NODE* buffer = read_directory(partition, directory_cluster, &entries, &clusters);
+    if(!buffer)
+        return result;
+
+    // First deleted entry or the end of directory can take a new node
+    uint32_t free_entry = entries;
+    for (uint32_t i = 0; i < entries; i++) {
+        if(buffer[i].filename[0] == '\0'){
+            free_entry = min(free_entry, i);
+            break;
+        }
+        if((uint8_t)buffer[i].filename[0] == 0xE5){
+            free_entry = min(free_entry, i);
+            continue;
+        }
+        if(buffer[i].attributes & FAT12_DA_VOLUME_ID || k_memcmp(name83, buffer[i].filename, 11))
+            continue;
+        result = (FAT12_NODE_INFO) {
+            .descriptor_sector = entry_sector(fat_partition, clusters, i),
+            .descriptor_offset = i % 16,
+            .node = buffer[i],
+            .parent_cluster = directory_cluster,
+        };
+        goto done;
+    }
+    if(!is_creating)
+        goto done;
+
+    if(free_entry < entries){
+        result.descriptor_sector = entry_sector(fat_partition, clusters, free_entry);
+        result.descriptor_offset = free_entry % 16;
+    }else if(directory_cluster != 0){
+        // Directory is full, it gets another cluster. Root directory has fixed size
+        uint32_t length = entries * sizeof(struct FAT12_NODE) / fat_partition->cluster_size;
+        uint32_t count = 1;
+        uint32_t* added = reserve_chain(partition, &count, clusters[length - 1]);
+        if(!added)
+            goto done;
+        k_memset(fat_partition->cluster_buffer, fat_partition->cluster_size, 0);
+        if(transfer_clusters(partition, added, 1, fat_partition->cluster_buffer, 1) == E_DEVICE_OK &&
+           flush_fat_buffer(partition) == E_DEVICE_OK)
+            result.descriptor_sector = cluster_sector(fat_partition, added[0]);
+        k_free(added);
+    }
+    result.node.filename[0] = (int8_t)0xE5; // Set it as deleted entry to indicate later that this is newly created field
+    result.parent_cluster = directory_cluster;
+
+    done:
+    k_free(buffer);
+    if(clusters)
+        k_free(clusters);
+    return result;
+}
+
+// Directory entry is patched in its sector, which is likely cached since the directory was just read
+static enum E_DEVICE save_descriptor(VFS_PARTITION* partition, FAT12_NODE_INFO* node_info){
+    // Root directory has no entry
+    if(node_info->descriptor_sector == 0)
+        return E_DEVICE_OK;
+
+    VFS_DEVICE* device = vfs_partition_get_device(partition);
+    struct FAT12_NODE entries[16];
+    enum E_DEVICE result = vfs_device_read(device, entries, 1, node_info->descriptor_sector);
+    if(result != E_DEVICE_OK)
+        return result;
+    entries[node_info->descriptor_offset] = node_info->node;
+    return vfs_device_write(device, entries, 1, node_info->descriptor_sector);
+}
+
+static int is_created(FAT12_NODE_INFO* node_info) {
+    if(!node_info)
+        return 0;
+    if(node_info->descriptor_sector == 0)
+        return 0;
+    return (uint8_t)node_info->node.filename[0] == 0xE5;
+}
+
+static int initialize_node(VFS_PARTITION *partition, FAT12_NODE_INFO *node_info,
+                           char *filename, uint32_t filename_length, int flags) {
+    if(!is_created(node_info) || filename_length == 0)
+        return 0;
+
+    // Empty files have no clusters, directories need one for "." and ".."
+    uint32_t first_cluster = 0;
+    if(flags & O_DIR){
+        uint32_t count = 1;
+        uint32_t* clusters = reserve_chain(partition, &count, 0);
+        if(!clusters)
+            return 0;
+        first_cluster = clusters[0];
+        k_free(clusters);
+    }
+
+    struct FAT12_NODE node = {};
+    make_8point3_name(filename, filename_length, (char*)node.filename);
+    node.attributes = (flags & O_DIR) ? FAT12_DA_DIR : 0;
+    node.start_low = first_cluster;
+    if((flags & O_DIR) && !initialize_directory_inside(partition, node_info, &node))
+        return 0;
+
+    // Entry is written last, so it never points to clusters which aren't ready
+    if(flush_fat_buffer(partition) != E_DEVICE_OK)
+        return 0;
+    struct FAT12_NODE created = node_info->node;
+    node_info->node = node;
+    if(save_descriptor(partition, node_info) != E_DEVICE_OK){
+        node_info->node = created;
+        return 0;
+    }
+    return 1;
+}
+
+static int initialize_directory_inside(VFS_PARTITION *partition, FAT12_NODE_INFO *node_info,
+                                       struct FAT12_NODE* node) {
+    FAT12_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    struct FAT12_NODE* buffer = (struct FAT12_NODE*)fat_partition->cluster_buffer;
+    k_memset(buffer, fat_partition->cluster_size, 0);
+    for (int i = 0; i < 11; ++i) {
+        buffer[0].filename[i] = ' ';
+        buffer[1].filename[i] = ' ';
+    }
+    buffer[0].filename[0] = '.';
+    buffer[1].filename[0] = '.';
+    buffer[1].filename[1] = '.';
+
+    // ".." of directories placed in root points to cluster 0
+    buffer[0].start_low = node->start_low;
+    buffer[1].start_low = node_info->parent_cluster;
+
+    buffer[0].attributes = FAT12_DA_DIR;
+    buffer[1].attributes = FAT12_DA_DIR;
+    uint32_t cluster = node->start_low;
+    return transfer_clusters(partition, &cluster, 1, (uint8_t*)buffer, 1) == E_DEVICE_OK;
+}
+
+static void free_node_info(FAT12_NODE_INFO* node_info) {
+    if(node_info->chain)
+        k_free(node_info->chain);
+    k_free(node_info);
+}
+
+///
+/// Resolving Path
+///
+static char to_upper_case(char c){
+    if('a' <= c && c <= 'z')
+        return 'A' + (c - 'a');
+    return c;
+}
+
+static int alphanumeric(char c){
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+// filename - char[] with length filename_length
+// buffer -   size of 11 bytes
+static void make_8point3_name(const char* filename, uint32_t filename_length, char* buffer){
+    for (int i = 0; i < 11; i++)
+        buffer[i] = ' ';
+
+    // Extension follows the last dot which has a character after it, so "." and ".." have none
+    uint32_t last_dot = filename_length;
+    for (uint32_t i = 0; i + 1 < filename_length; i++)
+        if(filename[i] == '.' && alphanumeric(filename[i + 1]))
+            last_dot = i;
+
+    for (uint32_t i = 0; i < last_dot && i < 8; i++)
+        buffer[i] = to_upper_case(filename[i]);
+    for (uint32_t i = 0; last_dot + 1 + i < filename_length && i < 3; i++)
+        buffer[8 + i] = to_upper_case(filename[last_dot + 1 + i]);
+}
+
+// Function takes a string and allocates a space for a string the same length and copy it
+static char* copy_str(const char* str) {
+    uint32_t len = str_len(str);
+    char* new_str = k_malloc(len + 1);
+    k_memcpy(str, new_str, len);
+    new_str[len] = 0;
+    return new_str;
+}
+
+// Last component of the path, trailing slashes aren't counted in its length
+static char* get_filename_from_path(const char* path, uint32_t* length) {
+    uint32_t end = str_len(path);
+    while(end > 0 && path[end - 1] == '/')
+        end--;
+    uint32_t start = end;
+    while(start > 0 && path[start - 1] != '/')
+        start--;
+    *length = end - start;
+    return (char*)&path[start];
+}
+
+static FAT12_NODE_INFO *resolve_path(const char *path, VFS_PARTITION *partition, FAT12_NODE_INFO *fat12_node, int flags){
+    char* copied_path = copy_str(path);
+    char* used_path = copied_path;
+
+    // Choose local or global root
+    if(*used_path == '/') {
+        fat12_node = 0;
+        used_path++;
+    }
+
+    // Root directory is described by a node without entry and clusters
+    FAT12_NODE_INFO info = {.node = {.attributes = FAT12_DA_DIR}};
+    if(fat12_node)
+        info = *fat12_node;
+    int found = 1;
+
+    // Go through directories and find till path empty using strtok
+    char* token = strtok(used_path, '/');
+    char* new_token = 0;
+    while(*token){
+        new_token = strtok(0, '/');
+        if(!(info.node.attributes & FAT12_DA_DIR)){
+            found = 0;
+            break;
+        }
+        info = find_node_in_directory(partition, token, &info, !*new_token && (flags & O_CREAT));
+        token = new_token;
+        if(info.descriptor_sector == 0){
+            found = 0;
+            break;
+        }
+    }
+    k_free(copied_path);
+    if(!found)
+        return 0;
+
+    FAT12_NODE_INFO* node_info = k_malloc(sizeof(FAT12_NODE_INFO));
+    *node_info = info;
+    node_info->chain = 0;
+    node_info->chain_length = 0;
+    return node_info;
+}
@@ -0,0 +1,137 @@
+#ifndef FAT12_H_
+#define FAT12_H_
+
+#include "vfs.h"
+#include "fat_cache.h"
+
+// Registers FAT12 or FAT16 volume found on the device if its type is one of formats
+enum E_PARTITION     fat12_find_partition(VFS_DEVICE *device, enum PARTITION_FORMAT formats);
+
+VFS_NODE*            fat12_open_file(VFS_PARTITION *partition, VFS_NODE* dir,
+                                     char* path, int flags);
+int                  fat12_create_file(VFS_PARTITION *partition, VFS_NODE* dir,
+                                       char* path, int flags);
+int                  fat12_remove_file(VFS_PARTITION *partition, VFS_NODE* dir,
+                                       char* path);
+
+VFS_NODE*            fat12_open_dir(VFS_PARTITION *partition, VFS_NODE* dir,
+                                    char* path);
+int                  fat12_make_dir(VFS_PARTITION *partition, VFS_NODE* dir,
+                                    char* path);
+int                  fat12_remove_dir(VFS_PARTITION *partition, VFS_NODE* dir,
+                                      char* path);
+
+int                  fat12_write_file (VFS_NODE* node, void* buffer, uint32_t size);
+int                  fat12_read_file  (VFS_NODE* node, void* buffer, uint32_t size);
+int                  fat12_lseek(VFS_NODE* node, int32_t offset, enum SEEK whence);
+int                  fat12_allocate_file(VFS_NODE* node, uint32_t size);
+
+int                  fat12_list_dir   (VFS_NODE* node, DIR_ENTRY* buffer, uint32_t size);
+
+// Writes FAT kept in memory to every FAT on the device
+int                  fat12_sync(VFS_PARTITION* partition);
+
+// Volumes with less data clusters than this use 12 bit FAT entries, bigger ones 16 bit
+#define FAT12_MAX_CLUSTERS 4085
+#define FAT16_MAX_CLUSTERS 65525
+
+struct FAT12_BPB {
+    uint8_t  jmp_signature[3];
+    uint8_t  oem_identifier[8];
+    uint16_t bytes_per_sector;
+    uint8_t  sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t  fats;
+    uint16_t directory_entries;
+    uint16_t sectors_in_volume;
+    uint8_t  media_descriptor_type;
+    uint16_t sectors_per_fat;
+    uint16_t sectors_per_track;
+    uint16_t heads_on_media;
+    uint32_t hidden_sectors;
+    uint32_t large_sectors_count;
+} __attribute__((packed)) ;
+
+struct FAT12_EBR {
+    uint8_t  drive_number;
+    uint8_t  windows_reserved;
+    uint8_t  signature;
+    uint8_t  volume_id[4];
+    int8_t   volume_label_string[11];
+    uint8_t  system_identifier_string[8];
+    uint8_t  boot_code[448];
+    uint16_t boot_signature;
+} __attribute__((packed));
+
+typedef union {
+    uint8_t buffer[512];
+    struct {
+        struct FAT12_BPB bpb;
+        struct FAT12_EBR ebr;
+    };
+} FAT12_BOOT_RECORD;
+
+enum FAT12_DIR_ATTR {
+    FAT12_DA_READ_ONLY = 0x01,
+    FAT12_DA_HIDDEN    = 0x02,
+    FAT12_DA_SYSTEM    = 0x04,
+    FAT12_DA_VOLUME_ID = 0x08,
+    FAT12_DA_DIR       = 0x10,
+    FAT12_DA_ARCHIVE   = 0x20,
+    FAT12_DA_LFN       = FAT12_DA_READ_ONLY | FAT12_DA_HIDDEN | FAT12_DA_SYSTEM | FAT12_DA_VOLUME_ID
+};
+
+struct FAT12_NODE {
+    int8_t   filename[11];
+    uint8_t  attributes;
+    uint8_t  reserved_NT;
+    uint8_t  creation_length;
+    uint16_t creation_time;
+    uint16_t creation_date;
+    uint16_t last_accessed_data;
+    uint16_t start_high; // Always 0 on FAT12/16
+    uint16_t last_modification_time;
+    uint16_t last_modification_date;
+    uint16_t start_low;
+    uint32_t size;
+} __attribute__((packed));
+
+typedef struct {
+    uint32_t descriptor_sector; // Sector holding the entry, 0 for root directory which has none
+    uint32_t descriptor_offset; // Entry number within the sector
+    struct FAT12_NODE node;
+    uint32_t parent_cluster;    // 0 if parent is root directory
+
+    uint32_t* chain;            // Clusters of the node in order, read on first access
+    uint32_t chain_length;
+} FAT12_NODE_INFO;
+
+typedef struct {
+    uint8_t  bits; // Size of FAT entry, 12 or 16
+    uint8_t  sectors_per_cluster;
+    uint16_t reserved_sectors; // FAT beginning sector
+    uint8_t  FATs;
+    uint16_t root_entries;
+    uint32_t sectors;
+    uint16_t sectors_per_fat;
+    uint32_t hidden_sectors;
+
+    int8_t label[11];
+
+    uint32_t fat_offset;
+    uint32_t root_offset;
+    uint32_t data_offset;
+
+    uint32_t root_size; // Sectors of fixed size root directory
+
+    uint32_t cluster_size; // Bytes in one cluster
+    uint8_t* cluster_buffer; // 1 cluster sized buffer for partial cluster access
+
+    uint32_t clusters;     // Number of FAT entries describing data clusters (including 2 reserved)
+    uint32_t search_start; // Cluster following the last allocated one
+    uint32_t end_of_chain; // FAT value written to the last cluster of a chain
+
+    FAT_CACHE fat_cache; // Recently used FAT sectors, shared implementation with FAT32
+} FAT12_PARTITION;
+
+#endif // FAT12_H_
@@ -1,4 +1,6 @@
 #include "fat32.h"
+#include "fat32_dentry.h"
+#include "fat32_dir_index.h"
 
 #include <stdint.h>
 
@@ -6,47 +8,82 @@
 #include "vfs.h"
 #include "../kernel/util.h"
 #include "../libc/strings.h"
+#include "../cpu/timer.h"
 
 typedef enum E_DEVICE (*CLUSTER_ACTION)(VFS_PARTITION* partition, uint32_t cluster, void* buffer, uint32_t size, uint32_t offset);
 
+static uint32_t max(uint32_t a, uint32_t b);
+static uint32_t min(uint32_t a, uint32_t b);
+
 // Partition intialization
-static FAT32_PARTITION* init_partition(FAT32_BOOT_RECORD* info);
+static FAT32_PARTITION* init_partition(VFS_DEVICE* device, FAT32_BOOT_RECORD* info, struct FAT32_FSINFO* fs_info);
+static void             init_free_space(FAT32_PARTITION* partition, struct FAT32_FSINFO* fs_info);
 
 // Partition state saving routines
 static enum E_DEVICE save_descriptor(VFS_PARTITION* partition, FAT32_NODE_INFO* node_info);
-static enum E_DEVICE save_current_fat(VFS_PARTITION *p);
+static enum E_DEVICE save_fat(VFS_PARTITION *p);
+static enum E_DEVICE save_fsinfo(VFS_PARTITION *p);
+static enum E_DEVICE flush_fat(VFS_PARTITION *p);
+static enum E_DEVICE flush_descriptors(VFS_PARTITION *p);
+static enum E_DEVICE defer_descriptor(VFS_PARTITION* partition, FAT32_NODE_INFO* node_info);
+static void          apply_dirty_descriptors(FAT32_PARTITION* partition, uint32_t cluster, struct FAT32_NODE* entries);
 
 // File access routines
 static int32_t write_bytes_in_file(VFS_NODE *node, void *buffer, uint32_t size);
 static int32_t read_bytes_from_file(VFS_NODE* node, void* buffer, uint32_t size);
+static void    read_ahead(VFS_PARTITION* partition, FAT32_NODE_INFO* info, uint32_t offset, uint32_t size);
 
 // Directory access routines
 static FAT32_NODE_INFO find_node_in_directory(VFS_PARTITION* partition, char* filename, struct FAT32_NODE* directory, int is_creating);
 static int is_created(FAT32_NODE_INFO* node_info);
 static int initialize_node(VFS_PARTITION *partition, FAT32_NODE_INFO *node_info, char *filename, int flags);
 static int initialize_directory_inside(VFS_PARTITION *partition, FAT32_NODE_INFO *node_info);
+static FAT32_DIR_INDEX* get_directory_index(VFS_PARTITION* partition, uint32_t directory);
+static FAT32_NODE_INFO find_node_in_index(VFS_PARTITION* partition, FAT32_DIR_INDEX* index, char* name83,
+                                          uint32_t directory, int is_creating);
+static void remember_node(VFS_PARTITION* partition, FAT32_NODE_INFO* node_info);
+static void forget_node(VFS_PARTITION* partition, FAT32_NODE_INFO* node_info);
 
 // Going through FAT
 static uint32_t traverse_fat_coroutine(VFS_PARTITION* partition, void* buffer, uint32_t cluster,
                                        uint32_t size, uint32_t offset,
-                                       CLUSTER_ACTION action, int is_allocating);
+                                       CLUSTER_ACTION action, uint32_t to_allocate);
 static uint32_t get_cluster_from_node(FAT32_PARTITION* partition ,struct FAT32_NODE* node);
-static uint32_t allocate_cluster(VFS_PARTITION* partition, uint32_t end_of_cluster);
-static uint32_t find_empty_cluster(VFS_PARTITION* partition);
+static uint32_t allocate_clusters(VFS_PARTITION* partition, uint32_t end_of_chain, uint32_t count);
+static enum E_DEVICE zero_clusters(VFS_PARTITION* partition, uint32_t first, uint32_t length);
+static uint32_t find_free_run(VFS_PARTITION* partition, uint32_t count, uint32_t* length);
+static enum E_DEVICE link_run(VFS_PARTITION* partition, uint32_t end_of_chain, uint32_t first, uint32_t length);
 static uint32_t get_next_cluster(VFS_PARTITION* p, uint32_t cluster);
+static enum E_DEVICE set_next_cluster(VFS_PARTITION* p, uint32_t cluster, uint32_t value);
 static FAT32_NODE_POSITION calculate_fat_position(FAT32_PARTITION* partition, uint32_t cluster);
-static enum E_DEVICE load_fat_sector(VFS_PARTITION* partition, uint32_t sector);
+
+// Mapping file clusters to disk clusters
+static uint32_t extent_map_lookup(VFS_PARTITION* partition, FAT32_NODE_INFO* info, uint32_t file_cluster);
+static uint32_t extent_map_run(VFS_PARTITION* partition, FAT32_NODE_INFO* info, uint32_t file_cluster,
+                               uint32_t max_length, uint32_t* length);
+static int      extent_map_append(FAT32_EXTENT_MAP* map, uint32_t file_cluster, uint32_t disk_cluster);
+static uint32_t extent_map_clusters(FAT32_EXTENT_MAP* map);
+static uint32_t reserve_file_clusters(VFS_PARTITION* partition, FAT32_NODE_INFO* info, uint32_t clusters);
+
+// Free space tracking
+static enum E_DEVICE used_clusters(VFS_PARTITION* partition, uint32_t cluster, uint32_t* word);
+static enum E_DEVICE scan_fat_sector(VFS_PARTITION* partition, uint32_t sector);
+static uint32_t used_bits(FAT32_PARTITION* partition, uint32_t* fat, uint32_t first);
+static void count_free_clusters(FAT32_PARTITION* partition, uint32_t sector, uint32_t* fat);
+static void update_free_space(FAT32_PARTITION* partition, uint32_t cluster, int is_free);
 
 // Partial cluster access routines
 static enum E_DEVICE read_part_cluster(VFS_PARTITION *partition, uint32_t cluster, void *buffer, uint32_t size, uint32_t offset);
 static enum E_DEVICE write_part_cluster(VFS_PARTITION *partition, uint32_t cluster, void *buffer, uint32_t size,
                                         uint32_t offset);
-static enum E_DEVICE idle_cluster(VFS_PARTITION *partition, uint32_t cluster, void *buffer, uint32_t size,
-                                  uint32_t offset);
 
 // Cluster access routines
 static enum E_DEVICE read_cluster(VFS_PARTITION *partition, uint32_t cluster, void *buffer);
 static enum E_DEVICE write_cluster(VFS_PARTITION *partition, uint32_t cluster, void *buffer);
+static enum E_DEVICE read_cluster_sectors(VFS_PARTITION *partition, uint32_t cluster, void *buffer,
+                                          uint32_t first, uint32_t count);
+static enum E_DEVICE write_cluster_sectors(VFS_PARTITION *partition, uint32_t cluster, void *buffer,
+                                           uint32_t first, uint32_t count);
 
 // Path resolving
 static void make_8point3_name(char* filename, uint32_t filename_length, char* buffer);
@@ -67,44 +104,88 @@ enum E_PARTITION fat32_find_partition(VFS_DEVICE *device){
         return E_PARTITION_DEVICE_FAILED;
     if(info.ebr.signature != 0x28 && info.ebr.signature != 0x29)
         return E_PARTITION_NO_FILESYSTEM_DETECTED;
+    // FAT12/16 keep these in BPB, boot code of their volumes could pass for FAT32 signature
+    if(info.bpb.sectors_per_fat != 0 || info.bpb.directory_entries != 0)
+        return E_PARTITION_NO_FILESYSTEM_DETECTED;
     if(info.ebr.boot_signature != 0xAA55)
         return E_PARTITINO_INVALID_SIGNATURE;
 
     struct FAT32_FSINFO fs_info;
-    vfs_device_read(device, &fs_info, 1, info.ebr.sector_of_FSInfo);
-    FAT32_PARTITION* fat_partition = init_partition(&info);
+    if(vfs_device_read(device, &fs_info, 1, info.ebr.sector_of_FSInfo) != E_DEVICE_OK)
+        fs_info.lead_signature = 0;
+    FAT32_PARTITION* fat_partition = init_partition(device, &info, &fs_info);
     VFS_PARTITION* _;
     vfs_register_partition(fat_partition, device, fat32_open_file, fat32_create_file,
-                           fat32_remove_file, fat32_open_dir, fat32_make_dir, fat32_remove_dir, _);
+                           fat32_remove_file, fat32_open_dir, fat32_make_dir, fat32_remove_dir, fat32_sync, _);
     return E_PARTITION_OK;
 }
 
-static FAT32_PARTITION* init_partition(FAT32_BOOT_RECORD* info){
+static FAT32_PARTITION* init_partition(VFS_DEVICE* device, FAT32_BOOT_RECORD* info, struct FAT32_FSINFO* fs_info){
     FAT32_PARTITION* partition = k_malloc(sizeof(FAT32_PARTITION));
 
     partition->sectors_per_cluster = info->bpb.sectors_per_cluster;
     partition->reserved_sectors = info->bpb.reserved_sectors;
     partition->FATs = info->bpb.fats;
     partition->root_entries = info->bpb.directory_entries;
-    partition->sectors = info->bpb.sectors_in_volume < 0xFFFF ?
+    partition->sectors = info->bpb.sectors_in_volume != 0 ?
         info->bpb.sectors_in_volume : info->bpb.large_sectors_count;
     partition->sectors_per_fat = info->ebr.sectors_per_fat;
     partition->hidden_sectors = info->bpb.hidden_sectors;
 
+    // Bit 7 of flags turns mirroring off, then low 4 bits select the only active FAT
+    partition->mirroring = !(info->ebr.flags & 0x80);
+    partition->active_fat = partition->mirroring ? 0 : info->ebr.flags & 0x0F;
+    if(partition->active_fat >= partition->FATs)
+        partition->active_fat = 0;
+
     partition->backup_boot_offset = info->ebr.sector_of_backup;
     partition->fsinfo_offset = info->ebr.sector_of_FSInfo;
     partition->fat_offset = info->bpb.reserved_sectors;
     partition->root_size = ((partition->root_entries * 32) + 511) / 512;
     partition->data_offset = partition->reserved_sectors + partition->FATs * partition->sectors_per_fat;
     partition->root_sector = info->ebr.cluster_of_root;
-    partition->buffer_loaded = 0;
-    partition->buffer_changed = 0;
+    partition->cluster_size = partition->sectors_per_cluster * 512;
+    partition->cluster_buffer = k_malloc(partition->cluster_size);
+    fat_cache_init(&partition->fat_cache, device, partition->fat_offset, partition->sectors_per_fat,
+                   partition->FATs, partition->active_fat, partition->mirroring, FAT_CACHE_DEFAULT_ENTRIES);
+    init_free_space(partition, fs_info);
+    partition->dentry_cache = fat32_dentry_cache_create(FAT32_DENTRY_DEFAULT_ENTRIES);
+    partition->dir_indexes = fat32_dir_index_create_table();
+    partition->write_back = 1;
+    partition->last_sync = timer_ticks();
+    partition->dirty_count = 0;
 
     k_memcpy(&info->ebr.volume_label, &partition->label, 11);
 
     return partition;
 }
 
+static void init_free_space(FAT32_PARTITION* partition, struct FAT32_FSINFO* fs_info){
+    // Count of clusters is limited both by size of volume and size of FAT
+    partition->clusters = min((partition->sectors - partition->data_offset) / partition->sectors_per_cluster + 2,
+                              partition->sectors_per_fat * 128);
+
+    // Bitmap covers one window of the FAT and is built lazily, one FAT sector at a time.
+    // Without it allocation looks at the cached FAT directly
+    partition->free_bitmap = k_malloc(FAT32_BITMAP_WINDOW * 128 / 8);
+    partition->window_start = 0;
+    k_memset(partition->window_scanned, sizeof(partition->window_scanned), 0);
+    partition->counted_sectors = 0;
+    partition->counted_free = 0;
+
+    // Trust FSInfo only if it's signed and sane
+    partition->fsinfo = *fs_info;
+    partition->fsinfo_changed = 0;
+    partition->fsinfo_valid = fs_info->lead_signature == FAT32_FSINFO_LEAD_SIGNATURE &&
+                              fs_info->middle_signature == FAT32_FSINFO_MIDDLE_SIGNATURE &&
+                              fs_info->trail_signature == FAT32_FSINFO_TRAIL_SIGNATURE;
+    if(!partition->fsinfo_valid || partition->fsinfo.free_clusters > partition->clusters - 2)
+        partition->fsinfo.free_clusters = FAT32_FSINFO_UNKNOWN;
+    if(!partition->fsinfo_valid || partition->fsinfo.search_start < 2 ||
+        partition->fsinfo.search_start >= partition->clusters)
+        partition->fsinfo.search_start = 2;
+}
+
 VFS_NODE*            fat32_open_file(VFS_PARTITION *partition, VFS_NODE* dir,
                                      char* path, int flags){
     // TODO: Implement flags checking
@@ -121,7 +202,8 @@ VFS_NODE*            fat32_open_file(VFS_PARTITION *partition, VFS_NODE* dir,
         return 0;
 
     VFS_NODE* file_descriptor;
-    vfs_file_create_descriptor(node_info, partition, fat32_write_file, fat32_read_file, fat32_lseek, 0, &file_descriptor);
+    vfs_file_create_descriptor(node_info, partition, fat32_write_file, fat32_read_file, fat32_lseek,
+                               fat32_allocate_file, 0, &file_descriptor);
 
     return file_descriptor;
 }
@@ -142,6 +224,7 @@ int                  fat32_remove_file(VFS_PARTITION *partition, VFS_NODE* dir,
         k_free(node_info);
         return 1;
     }
+    forget_node(partition, node_info);
     node_info->node.filename[0] = (int8_t)0xE5;
     save_descriptor(partition, node_info);
     delete_fat_chain(partition, get_cluster_from_node(fat_partition, &node_info->node));
@@ -158,7 +241,7 @@ VFS_NODE*            fat32_open_dir(VFS_PARTITION *partition, VFS_NODE* dir,
         return 0;
 
     VFS_NODE* file_descriptor;
-    vfs_file_create_descriptor(node_info, partition, 0, 0, 0, fat32_list_dir, &file_descriptor);
+    vfs_file_create_descriptor(node_info, partition, 0, 0, 0, 0, fat32_list_dir, &file_descriptor);
 
     return file_descriptor;
 }
@@ -191,6 +274,37 @@ static uint32_t min(uint32_t a, uint32_t b){
     return (a > b) ? b : a;
 }
 
+int                  fat32_set_fat_cache_size(VFS_PARTITION* partition, uint32_t sectors){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    if(!fat_partition)
+        return 1;
+    return fat_cache_resize(&fat_partition->fat_cache, sectors) != E_DEVICE_OK;
+}
+
+int                  fat32_sync(VFS_PARTITION* partition){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    if(!fat_partition)
+        return 1;
+    fat_partition->last_sync = timer_ticks();
+    if(flush_descriptors(partition) != E_DEVICE_OK)
+        return 1;
+    if(flush_fat(partition) != E_DEVICE_OK)
+        return 1;
+    return fat_cache_mirror(&fat_partition->fat_cache) != E_DEVICE_OK;
+}
+
+int                  fat32_set_write_back(VFS_PARTITION* partition, int enabled){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    if(!fat_partition)
+        return 1;
+
+    // Nothing may stay behind once changes are written through
+    if(!enabled && fat32_sync(partition))
+        return 1;
+    fat_partition->write_back = enabled;
+    return 0;
+}
+
 int                  fat32_write_file (VFS_NODE* node, void* buffer, uint32_t size){
     int32_t bytes_written = write_bytes_in_file(node, buffer, size);
     vfs_node_move_offset(node, bytes_written);
@@ -211,20 +325,43 @@ int                  fat32_read_file  (VFS_NODE* node, void* buffer, uint32_t si
 int                  fat32_lseek(VFS_NODE* node, int32_t offset, enum SEEK whence) {
     if(!node)
         return -E_LSEEK_BADF;
+    // Calculate new absolute position
+    int32_t position;
     if(whence == SEEK_SET){
-        if(offset > vfs_node_get_offset(node))
-            vfs_node_move_offset(node, offset - vfs_node_get_offset(node));
-        else
-            vfs_node_move_offset(node, -vfs_node_get_offset(node));
+        position = offset;
     } else if(whence == SEEK_CUR){
-        vfs_node_move_offset(node, offset);
+        position = vfs_node_get_offset(node) + offset;
     } else if(whence == SEEK_END){
         FAT32_NODE_INFO* info = vfs_node_get_data(node);
-        vfs_node_move_offset(node, (int32_t)info->node.size + offset);
+        position = (int32_t)info->node.size + offset;
     }else {
         return -E_LSEEK_INVAL;
     }
-    return vfs_node_get_offset(node);
+    if(position < 0)
+        return -E_LSEEK_INVAL;
+
+    // Clusters are resolved through extent map on next access so nothing has to be walked here
+    return vfs_node_move_offset(node, position - vfs_node_get_offset(node));
+}
+
+int                  fat32_allocate_file(VFS_NODE* node, uint32_t size){
+    FAT32_NODE_INFO* info = vfs_node_get_data(node);
+    VFS_PARTITION* partition = vfs_node_get_partition(node);
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    if(!info)
+        return -1;
+
+    // Reserve missing clusters as contiguously as possible
+    uint32_t needed = max((size + fat_partition->cluster_size - 1) / fat_partition->cluster_size, 1);
+    if(reserve_file_clusters(partition, info, needed) < needed)
+        return -1;
+
+    info->node.size = max(info->node.size, size);
+    if(save_fat(partition) != E_DEVICE_OK)
+        return -1;
+    if(save_descriptor(partition, info) != E_DEVICE_OK)
+        return -1;
+    return 0;
 }
 
 int                  fat32_list_dir   (VFS_NODE* node, DIR_ENTRY* buffer, uint32_t size){
@@ -241,14 +378,19 @@ int                  fat32_list_dir   (VFS_NODE* node, DIR_ENTRY* buffer, uint32
     // Initialize variables
     uint32_t cluster = get_cluster_from_node(fat_partition, &info->node);
     uint32_t entries_read = 0;
-    struct FAT32_NODE fat32_entries[512 / sizeof(struct FAT32_NODE)];
+    uint32_t entries_per_cluster = fat_partition->cluster_size / sizeof(struct FAT32_NODE);
+    struct FAT32_NODE* fat32_entries = k_malloc(fat_partition->cluster_size);
 
     // Traverse the directory clusters
     while (cluster && entries_read < size) {
-        cluster = traverse_fat_coroutine(partition, fat32_entries, cluster, 512, 0, read_part_cluster, 0);
-        for (int i = 0; i < 16 && entries_read < size; i++) {
+        uint32_t current_cluster = cluster;
+        cluster = traverse_fat_coroutine(partition, fat32_entries, cluster, fat_partition->cluster_size, 0,
+                                         read_part_cluster, 0);
+        apply_dirty_descriptors(fat_partition, current_cluster, fat32_entries);
+        for (int i = 0; i < entries_per_cluster && entries_read < size; i++) {
             if (fat32_entries[i].filename[0] == '\0') {
                 // End of directory
+                k_free(fat32_entries);
                 return 0;
             }
             if ((uint8_t)fat32_entries[i].filename[0] == 0xE5) {
@@ -261,6 +403,7 @@ int                  fat32_list_dir   (VFS_NODE* node, DIR_ENTRY* buffer, uint32
     }
 
     // Update size with the number of entries read
+    k_free(fat32_entries);
     return (int)entries_read;
 }
 
@@ -268,7 +411,6 @@ int                  fat32_list_dir   (VFS_NODE* node, DIR_ENTRY* buffer, uint32
 /// Static helper functions
 ///
 static int delete_fat_chain(VFS_PARTITION *partition, uint32_t start_cluster) {
-    FAT32_PARTITION *fat_partition = vfs_partition_get_data(partition);
     uint32_t current_cluster = start_cluster;
     uint32_t next_cluster;
 
@@ -276,16 +418,13 @@ static int delete_fat_chain(VFS_PARTITION *partition, uint32_t start_cluster) {
         next_cluster = get_next_cluster(partition, current_cluster);
 
         // Mark the current cluster as free
-        FAT32_NODE_POSITION pos = calculate_fat_position(fat_partition, current_cluster);
-        load_fat_sector(partition, pos.sector);
-        fat_partition->buffer[pos.offset] = 0x00000000;
-        fat_partition->buffer_changed = 1;
+        set_next_cluster(partition, current_cluster, 0x00000000);
 
         current_cluster = next_cluster;
     }
 
     // Save the changes to the FAT
-    return save_current_fat(partition);
+    return save_fat(partition);
 }
 
 static DIR_ENTRY fat32_entry_to_dir_entry(struct FAT32_NODE* node) {
@@ -302,67 +441,139 @@ static int32_t read_bytes_from_file(VFS_NODE* node, void* buffer, uint32_t size)
     FAT32_NODE_INFO* info = vfs_node_get_data(node);
     VFS_PARTITION* partition = vfs_node_get_partition(node);
     FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
-    int32_t offset = vfs_node_get_offset(node);
+    uint32_t offset = vfs_node_get_offset(node);
+    uint8_t* destination = buffer;
 
-    uint32_t max_size = info->node.size - offset;
-    size = min(size, max_size);
+    if(offset >= info->node.size)
+        return 0;
+    size = min(size, info->node.size - offset);
+    read_ahead(partition, info, offset, size);
 
-    // Traverse to the current offset of a file descriptor
-    uint32_t current_cluster = get_cluster_from_node(fat_partition, &info->node);
-    while(offset > 512){
-        current_cluster = traverse_fat_coroutine(partition, buffer, current_cluster, 512,
-            0, idle_cluster, 1);
-        offset -= 512;
-    }
+    // Find cluster containing current offset of a file descriptor
+    uint32_t file_cluster = offset / fat_partition->cluster_size;
+    offset %= fat_partition->cluster_size;
 
     // Read buffer not allocating anything along the way till end of file OR size
     int32_t bytes_read = 0;
     while(size > 0){
-        uint32_t bytes_to_read = min(size, 512 - offset);
-        current_cluster = traverse_fat_coroutine(partition, &buffer[bytes_read], current_cluster, bytes_to_read,
-            offset, read_part_cluster, 0);
+        // Physically adjacent full clusters are transferred with one request
+        uint32_t full_clusters = offset == 0 ? size / fat_partition->cluster_size : 0;
+        uint32_t length;
+        uint32_t current_cluster = extent_map_run(partition, info, file_cluster, max(full_clusters, 1), &length);
+        if(current_cluster == 0)
+            break;
+        uint32_t bytes_to_read;
+        enum E_DEVICE result;
+        if(full_clusters){
+            bytes_to_read = length * fat_partition->cluster_size;
+            result = read_cluster_sectors(partition, current_cluster, &destination[bytes_read], 0,
+                                          length * fat_partition->sectors_per_cluster);
+        }else {
+            bytes_to_read = min(size, fat_partition->cluster_size - offset);
+            result = read_part_cluster(partition, current_cluster, &destination[bytes_read], bytes_to_read, offset);
+        }
+        if(result != E_DEVICE_OK)
+            break;
+        file_cluster += length;
         bytes_read += (int32_t)bytes_to_read;
         offset = 0;
-        if(current_cluster == 0)
-            return bytes_read;
         size -= bytes_to_read;
     }
 
     return bytes_read;
 }
 
+static void    read_ahead(VFS_PARTITION* partition, FAT32_NODE_INFO* info, uint32_t offset, uint32_t size) {
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    FAT32_READ_AHEAD* state = &info->read_ahead;
+    uint32_t cluster_size = fat_partition->cluster_size;
+
+    // Any jump away from where the previous read ended starts detection over
+    int sequential = offset == state->next_offset;
+    state->next_offset = offset + size;
+    if(!sequential){
+        state->window = 0;
+        state->end = 0;
+        return;
+    }
+
+    // Wait till the read catches up with the second half of the window
+    uint32_t next = (offset + size) / cluster_size;
+    if(state->window && state->end > next + state->window / 2)
+        return;
+
+    // Window doubles every time it is used up
+    uint32_t min_window = max(FAT32_READ_AHEAD_MIN / cluster_size, 1);
+    uint32_t max_window = max(FAT32_READ_AHEAD_MAX / cluster_size, 1);
+    state->window = state->window ? min(state->window * 2, max_window) : min_window;
+
+    // Small reads are served from the cache too, bigger ones already go to the device whole
+    uint32_t start = max(state->end, size < cluster_size ? offset / cluster_size : next);
+    uint32_t end = min(next + state->window, (info->node.size + cluster_size - 1) / cluster_size);
+    state->end = max(state->end, end);
+
+    VFS_DEVICE* device = vfs_partition_get_device(partition);
+    while(start < end){
+        uint32_t length;
+        uint32_t cluster = extent_map_run(partition, info, start, end - start, &length);
+        if(cluster == 0)
+            break;
+        if(vfs_device_prefetch(device, length * fat_partition->sectors_per_cluster,
+                               fat_partition->data_offset + (cluster - 2) * fat_partition->sectors_per_cluster) != E_DEVICE_OK)
+            break;
+        start += length;
+    }
+}
+
 static int32_t write_bytes_in_file(VFS_NODE *node, void *buffer, uint32_t size) {
     // Get Information
     FAT32_NODE_INFO* info = vfs_node_get_data(node);
     VFS_PARTITION* partition = vfs_node_get_partition(node);
     FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
-    int32_t offset = vfs_node_get_offset(node);
-    int32_t starting_offset = offset;
+    uint32_t offset = vfs_node_get_offset(node);
+    uint8_t* source = buffer;
+    uint32_t starting_offset = offset;
+    if(size == 0)
+        return 0;
 
-    // Traverse to the current offset of a file descriptor
-    uint32_t current_cluster = get_cluster_from_node(fat_partition, &info->node);
-    while(offset > 512){
-        current_cluster = traverse_fat_coroutine(partition, buffer, current_cluster, 512,
-            0, idle_cluster, 1);
-        offset -= 512;
-    }
+    // Make sure the chain reaches the end of the write, reserving everything missing at once
+    reserve_file_clusters(partition, info,
+                          (offset + size + fat_partition->cluster_size - 1) / fat_partition->cluster_size);
+
+    // Find cluster containing current offset of a file descriptor
+    uint32_t file_cluster = offset / fat_partition->cluster_size;
+    offset %= fat_partition->cluster_size;
 
-    // Write buffer maybe allocating new FATs along the way
+    // Write buffer till the end of reserved clusters
     int32_t bytes_written = 0;
     while(size > 0){
-        uint32_t bytes_to_write = min(size, 512 - offset);
-        current_cluster = traverse_fat_coroutine(partition, &buffer[bytes_written], current_cluster, bytes_to_write,
-            offset, write_part_cluster, bytes_to_write < size);
-        bytes_written += (int32_t)bytes_to_write;
-        offset = 0;
+        // Physically adjacent full clusters are transferred with one request
+        uint32_t full_clusters = offset == 0 ? size / fat_partition->cluster_size : 0;
+        uint32_t length;
+        uint32_t current_cluster = extent_map_run(partition, info, file_cluster, max(full_clusters, 1), &length);
         if(current_cluster == 0)
             break;
+        uint32_t bytes_to_write;
+        enum E_DEVICE result;
+        if(full_clusters){
+            bytes_to_write = length * fat_partition->cluster_size;
+            result = write_cluster_sectors(partition, current_cluster, &source[bytes_written], 0,
+                                          length * fat_partition->sectors_per_cluster);
+        }else {
+            bytes_to_write = min(size, fat_partition->cluster_size - offset);
+            result = write_part_cluster(partition, current_cluster, &source[bytes_written], bytes_to_write, offset);
+        }
+        if(result != E_DEVICE_OK)
+            break;
+        file_cluster += length;
+        bytes_written += (int32_t)bytes_to_write;
+        offset = 0;
         size -= bytes_to_write;
     }
 
     // Return the number of bytes written
     info->node.size = max(info->node.size, starting_offset + bytes_written);
-    save_current_fat(partition);
+    save_fat(partition);
     save_descriptor(partition, info);
 
     return bytes_written;
@@ -370,12 +581,61 @@ static int32_t write_bytes_in_file(VFS_NODE *node, void *buffer, uint32_t size)
 }
 
 static enum E_DEVICE save_descriptor(VFS_PARTITION* partition, FAT32_NODE_INFO* node_info){
-    VFS_DEVICE* device = vfs_partition_get_device(partition);
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+
+    // Keep cached name lookups in sync with what is on disk
+    remember_node(partition, node_info);
+    if(fat_partition->write_back)
+        return defer_descriptor(partition, node_info);
     return write_part_cluster(partition, node_info->descriptor_cluster, &node_info->node,
         sizeof(struct FAT32_NODE),
         node_info->descriptor_offset * sizeof(struct FAT32_NODE));
 }
 
+static enum E_DEVICE defer_descriptor(VFS_PARTITION* partition, FAT32_NODE_INFO* node_info){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+
+    // Later change of the same entry replaces earlier one
+    FAT32_DIRTY_DESCRIPTOR* dirty = 0;
+    for (uint32_t i = 0; i < fat_partition->dirty_count; i++) {
+        if(fat_partition->dirty_descriptors[i].cluster == node_info->descriptor_cluster &&
+           fat_partition->dirty_descriptors[i].offset == node_info->descriptor_offset)
+            dirty = &fat_partition->dirty_descriptors[i];
+    }
+    if(!dirty){
+        if(fat_partition->dirty_count == FAT32_DIRTY_DESCRIPTORS){
+            enum E_DEVICE result = flush_descriptors(partition);
+            if(result != E_DEVICE_OK)
+                return result;
+        }
+        dirty = &fat_partition->dirty_descriptors[fat_partition->dirty_count++];
+        dirty->cluster = node_info->descriptor_cluster;
+        dirty->offset = node_info->descriptor_offset;
+    }
+    dirty->node = node_info->node;
+    return E_DEVICE_OK;
+}
+
+static enum E_DEVICE flush_descriptors(VFS_PARTITION *p){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(p);
+    while(fat_partition->dirty_count > 0){
+        FAT32_DIRTY_DESCRIPTOR* dirty = &fat_partition->dirty_descriptors[fat_partition->dirty_count - 1];
+        enum E_DEVICE result = write_part_cluster(p, dirty->cluster, &dirty->node, sizeof(struct FAT32_NODE),
+                                                  dirty->offset * sizeof(struct FAT32_NODE));
+        if(result != E_DEVICE_OK)
+            return result;
+        fat_partition->dirty_count--;
+    }
+    return E_DEVICE_OK;
+}
+
+// Directory clusters read from device don't contain entries waiting to be written yet
+static void          apply_dirty_descriptors(FAT32_PARTITION* partition, uint32_t cluster, struct FAT32_NODE* entries){
+    for (uint32_t i = 0; i < partition->dirty_count; i++)
+        if(partition->dirty_descriptors[i].cluster == cluster)
+            entries[partition->dirty_descriptors[i].offset] = partition->dirty_descriptors[i].node;
+}
+
 static FAT32_NODE_POSITION calculate_fat_position(FAT32_PARTITION *p, uint32_t cluster){
     FAT32_NODE_POSITION pos = {
          .sector = cluster / 128,
@@ -384,157 +644,511 @@ static FAT32_NODE_POSITION calculate_fat_position(FAT32_PARTITION *p, uint32_t c
     return pos;
 }
 
-static enum E_DEVICE save_current_fat(VFS_PARTITION *p){
+static enum E_DEVICE save_fat(VFS_PARTITION *p){
     FAT32_PARTITION* fat_partition = vfs_partition_get_data(p);
+    if(!fat_partition->write_back){
+        enum E_DEVICE result = flush_fat(p);
+        if(result != E_DEVICE_OK)
+            return result;
+        return fat_cache_mirror(&fat_partition->fat_cache);
+    }
 
-    // If buffer didn't change or is not loaded no point in saving it
-    if(!fat_partition->buffer_changed || !fat_partition->buffer_loaded) return 0;
+    // Batched changes are written once sync interval passes
+    uint32_t frequency = timer_frequency();
+    if(frequency && timer_ticks() - fat_partition->last_sync >= FAT32_SYNC_INTERVAL_MS * frequency / 1000)
+        return fat32_sync(p) ? E_DEVICE_WRITE_FAILED : E_DEVICE_OK;
+    return E_DEVICE_OK;
+}
 
-    // Otherwise write changed fat to the disk
-    VFS_DEVICE* device = vfs_partition_get_device(p);
+static enum E_DEVICE flush_fat(VFS_PARTITION *p){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(p);
+    enum E_DEVICE result = fat_cache_flush(&fat_partition->fat_cache);
+    if(result != E_DEVICE_OK)
+        return result;
+    return save_fsinfo(p);
+}
 
-    // Write first FAT
-    enum E_DEVICE result = vfs_device_write(device, fat_partition->buffer, 1, fat_partition->current_sector + fat_partition->fat_offset);
-    if(result != E_DEVICE_OK) return result;
+static enum E_DEVICE save_fsinfo(VFS_PARTITION *p){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(p);
 
-    // Write second FAT
-    result = vfs_device_write(device, fat_partition->buffer, 1,
-        fat_partition->current_sector + fat_partition->fat_offset + fat_partition->sectors_per_fat);
+    // Never write over something that isn't FSInfo
+    if(!fat_partition->fsinfo_changed || !fat_partition->fsinfo_valid)
+        return E_DEVICE_OK;
 
-    // Unset dirty bit
-    fat_partition->buffer_changed = 0;
+    VFS_DEVICE* device = vfs_partition_get_device(p);
+    enum E_DEVICE result = vfs_device_write(device, &fat_partition->fsinfo, 1, fat_partition->fsinfo_offset);
+    if(result == E_DEVICE_OK)
+        fat_partition->fsinfo_changed = 0;
     return result;
 }
 
-static enum E_DEVICE load_fat_sector(VFS_PARTITION* p, uint32_t sector){
+static uint32_t get_next_cluster(VFS_PARTITION* p, uint32_t cluster){
     FAT32_PARTITION* fat_partition = vfs_partition_get_data(p);
-    // No need to load if it's here
-    if(fat_partition->current_sector == sector && fat_partition->buffer_loaded) return 0;
 
-    // Save previous fat before doing anything stupid
-    int result = save_current_fat(p);
-    if(result != E_DEVICE_OK) return result;
+    // Calculate position
+    FAT32_NODE_POSITION pos = calculate_fat_position(fat_partition, cluster);
+    uint32_t* fat;
+    if(fat_cache_load(&fat_partition->fat_cache, pos.sector, (uint8_t**)&fat) != E_DEVICE_OK)
+        return 0;
 
-    // Read new sector to the cache buffer
-    VFS_DEVICE* device = vfs_partition_get_device(p);
-    result = vfs_device_read(device, fat_partition->buffer, 1, sector + fat_partition->fat_offset);
-    if(result == E_DEVICE_OK){
-        fat_partition->buffer_loaded = 1;
-        fat_partition->current_sector = sector;
-    }
-    return result;
+    // Upper 4 bits are reserved
+    return fat[pos.offset] & 0x0FFFFFFF;
 }
 
-static uint32_t get_next_cluster(VFS_PARTITION* p, uint32_t cluster){
+static enum E_DEVICE set_next_cluster(VFS_PARTITION* p, uint32_t cluster, uint32_t value){
     FAT32_PARTITION* fat_partition = vfs_partition_get_data(p);
 
     // Calculate position
     FAT32_NODE_POSITION pos = calculate_fat_position(fat_partition, cluster);
-    load_fat_sector(p, pos.sector);
+    uint32_t* fat;
+    enum E_DEVICE result = fat_cache_load(&fat_partition->fat_cache, pos.sector, (uint8_t**)&fat);
+    if(result != E_DEVICE_OK)
+        return result;
+
+    // Keep free space information in sync
+    int was_free = (fat[pos.offset] & 0x0FFFFFFF) == 0;
+    int is_free = (value & 0x0FFFFFFF) == 0;
+    if(was_free != is_free)
+        update_free_space(fat_partition, cluster, is_free);
+
+    // Preserve reserved bits
+    fat[pos.offset] = (fat[pos.offset] & 0xF0000000) | (value & 0x0FFFFFFF);
+    fat_cache_set_changed(&fat_partition->fat_cache, pos.sector);
+    return E_DEVICE_OK;
+}
 
-    uint32_t next_cluster = fat_partition->buffer[pos.offset];
-    return next_cluster;
+static enum E_DEVICE link_run(VFS_PARTITION* partition, uint32_t end_of_chain, uint32_t first, uint32_t length){
+    // Attach run to the end of existing chain
+    enum E_DEVICE result;
+    if(end_of_chain != 0){
+        result = set_next_cluster(partition, end_of_chain, first);
+        if(result != E_DEVICE_OK)
+            return result;
+    }
+
+    // Adjacent entries share FAT sectors so this is a single pass over the cached window
+    for (uint32_t i = 0; i < length; i++) {
+        result = set_next_cluster(partition, first + i, i + 1 < length ? first + i + 1 : 0xFFFFFFF);
+        if(result != E_DEVICE_OK)
+            return result;
+    }
+    return E_DEVICE_OK;
 }
 
-static enum E_DEVICE change_fat(VFS_PARTITION *partition, uint32_t end_of_chain_cluster, uint32_t new_cluster){
+///
+/// Extent map
+///
+static uint32_t extent_map_lookup(VFS_PARTITION* partition, FAT32_NODE_INFO* info, uint32_t file_cluster){
+    FAT32_EXTENT_MAP* map = &info->extent_map;
+
+    // Sequential access hits the same or the following extent
+    for (uint32_t i = map->last_hit; i < map->count && i <= map->last_hit + 1; i++) {
+        FAT32_EXTENT* extent = &map->extents[i];
+        if(file_cluster >= extent->file_cluster && file_cluster - extent->file_cluster < extent->length){
+            map->last_hit = i;
+            return extent->disk_cluster + file_cluster - extent->file_cluster;
+        }
+    }
+
+    // Binary search through already mapped part of the chain
+    if(file_cluster < extent_map_clusters(map)){
+        uint32_t low = 0, high = map->count - 1;
+        while(low < high){
+            uint32_t middle = (low + high + 1) / 2;
+            if(map->extents[middle].file_cluster <= file_cluster)
+                low = middle;
+            else
+                high = middle - 1;
+        }
+        map->last_hit = low;
+        return map->extents[low].disk_cluster + file_cluster - map->extents[low].file_cluster;
+    }
+
+    // Extend map by walking FAT from the last mapped cluster
     FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    uint32_t mapped = extent_map_clusters(map);
+    while(mapped <= file_cluster){
+        uint32_t cluster;
+        if(map->count == 0){
+            cluster = get_cluster_from_node(fat_partition, &info->node);
+        }else {
+            FAT32_EXTENT* last = &map->extents[map->count - 1];
+            cluster = get_next_cluster(partition, last->disk_cluster + last->length - 1);
+        }
+        if(cluster < 2 || cluster >= 0xFFFFFF8)
+            return 0; // Chain ends before requested cluster
+        if(extent_map_append(map, mapped, cluster))
+            return 0;
+        mapped++;
+    }
+    map->last_hit = map->count - 1;
+    FAT32_EXTENT* last = &map->extents[map->last_hit];
+    return last->disk_cluster + file_cluster - last->file_cluster;
+}
+
+// Returns disk cluster of file_cluster and how many clusters after it (up to max_length) follow it on disk
+static uint32_t extent_map_run(VFS_PARTITION* partition, FAT32_NODE_INFO* info, uint32_t file_cluster,
+                               uint32_t max_length, uint32_t* length){
+    FAT32_EXTENT_MAP* map = &info->extent_map;
+    uint32_t cluster = extent_map_lookup(partition, info, file_cluster);
+    *length = 0;
+    if(cluster == 0)
+        return 0;
+
+    *length = 1;
+    while(*length < max_length){
+        FAT32_EXTENT* extent = &map->extents[map->last_hit];
+        uint32_t left = extent->file_cluster + extent->length - file_cluster;
+        if(left >= max_length){
+            *length = max_length;
+            break;
+        }
+        *length = left;
+
+        // Last extent might continue past the mapped part of the chain
+        if(extent_map_lookup(partition, info, file_cluster + left) != cluster + left)
+            break;
+    }
+    return cluster;
+}
+
+static int      extent_map_append(FAT32_EXTENT_MAP* map, uint32_t file_cluster, uint32_t disk_cluster){
+    // Grow the last extent if cluster continues it
+    if(map->count > 0){
+        FAT32_EXTENT* last = &map->extents[map->count - 1];
+        if(last->disk_cluster + last->length == disk_cluster){
+            last->length++;
+            return 0;
+        }
+    }
+
+    // Otherwise start a new one
+    if(map->count == map->capacity){
+        uint32_t capacity = map->capacity ? map->capacity * 2 : 4;
+        FAT32_EXTENT* extents = k_realloc(map->extents, capacity * sizeof(FAT32_EXTENT));
+        if(!extents)
+            return 1;
+        map->extents = extents;
+        map->capacity = capacity;
+    }
+    map->extents[map->count++] = (FAT32_EXTENT) {file_cluster, disk_cluster, 1};
+    return 0;
+}
+
+static uint32_t extent_map_clusters(FAT32_EXTENT_MAP* map){
+    if(map->count == 0)
+        return 0;
+    FAT32_EXTENT* last = &map->extents[map->count - 1];
+    return last->file_cluster + last->length;
+}
+
+// Makes sure chain of a file has at least given amount of clusters, returns how many it has (up to clusters)
+static uint32_t reserve_file_clusters(VFS_PARTITION* partition, FAT32_NODE_INFO* info, uint32_t clusters){
+    if(clusters == 0 || extent_map_lookup(partition, info, clusters - 1))
+        return clusters;
+
+    // Lookup failed so map now covers the whole chain
+    FAT32_EXTENT_MAP* map = &info->extent_map;
+    uint32_t have = extent_map_clusters(map);
+    uint32_t last_cluster = 0;
+    if(map->count > 0)
+        last_cluster = map->extents[map->count - 1].disk_cluster + map->extents[map->count - 1].length - 1;
+
+    uint32_t first_cluster = allocate_clusters(partition, last_cluster, clusters - have);
+    if(first_cluster == 0)
+        return have;
+    if(last_cluster == 0){
+        // File had no clusters yet
+        info->node.start_high = first_cluster >> 16;
+        info->node.start_low = first_cluster;
+        save_descriptor(partition, info);
+    }
+
+    // New clusters are picked up by walking the chain, allocation may have stopped short
+    for (; have < clusters; have++)
+        if(extent_map_lookup(partition, info, have) == 0)
+            break;
+    return have;
+}
 
-    // Calculate positions
-    const FAT32_NODE_POSITION old_pos = calculate_fat_position(fat_partition, end_of_chain_cluster);
-    const FAT32_NODE_POSITION new_pos = calculate_fat_position(fat_partition, new_cluster);
+// Fills word with a bit set for every cluster in use among the 32 sharing a bitmap word with cluster
+static enum E_DEVICE used_clusters(VFS_PARTITION* partition, uint32_t cluster, uint32_t* word){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    uint32_t sector = cluster / 128;
+    if(!fat_partition->free_bitmap){
+        uint32_t* fat;
+        enum E_DEVICE result = fat_cache_load(&fat_partition->fat_cache, sector, (uint8_t**)&fat);
+        if(result != E_DEVICE_OK)
+            return result;
+        count_free_clusters(fat_partition, sector, fat);
+        *word = used_bits(fat_partition, fat, cluster & ~31u);
+        return E_DEVICE_OK;
+    }
 
-    // Write new values
-    enum E_DEVICE result = load_fat_sector(partition, old_pos.sector);
+    enum E_DEVICE result = scan_fat_sector(partition, sector);
     if(result != E_DEVICE_OK)
         return result;
-    fat_partition->buffer[old_pos.offset] = new_cluster;
-    fat_partition->buffer_changed = 1;
+    *word = fat_partition->free_bitmap[(cluster - fat_partition->window_start * 128) / 32];
+    return E_DEVICE_OK;
+}
 
-    result = load_fat_sector(partition, new_pos.sector);
+static enum E_DEVICE scan_fat_sector(VFS_PARTITION* partition, uint32_t sector){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+
+    // Window moves to the sector, what was scanned in the previous one is forgotten
+    if(sector < fat_partition->window_start || sector >= fat_partition->window_start + FAT32_BITMAP_WINDOW){
+        fat_partition->window_start = sector - sector % FAT32_BITMAP_WINDOW;
+        k_memset(fat_partition->window_scanned, sizeof(fat_partition->window_scanned), 0);
+    }
+    uint32_t index = sector - fat_partition->window_start;
+    if(fat_partition->window_scanned[index / 8] & (1 << (index % 8)))
+        return E_DEVICE_OK;
+
+    uint32_t* fat;
+    enum E_DEVICE result = fat_cache_load(&fat_partition->fat_cache, sector, (uint8_t**)&fat);
     if(result != E_DEVICE_OK)
         return result;
-    fat_partition->buffer[new_pos.offset] = 0xFFFFFFF;
-    fat_partition->buffer_changed = 1;
-    save_current_fat(partition);
+
+    // Every FAT sector describes exactly 4 words of bitmap
+    for (uint32_t i = 0; i < 4; i++)
+        fat_partition->free_bitmap[index * 4 + i] = used_bits(fat_partition, fat, sector * 128 + i * 32);
+    fat_partition->window_scanned[index / 8] |= 1 << (index % 8);
+    count_free_clusters(fat_partition, sector, fat);
+    return E_DEVICE_OK;
+}
+
+// Bit set for every cluster in use among 32 starting at first, fat holds the FAT sector describing them
+static uint32_t used_bits(FAT32_PARTITION* partition, uint32_t* fat, uint32_t first){
+    uint32_t word = 0;
+    for (uint32_t i = 0; i < 32; i++) {
+        uint32_t cluster = first + i;
+        // Reserved clusters and entries past the end of volume are never free
+        if(cluster < 2 || cluster >= partition->clusters || (fat[cluster % 128] & 0x0FFFFFFF) != 0)
+            word |= 1u << i;
+    }
+    return word;
+}
+
+// Free clusters are counted in FAT order as sectors get scanned, the count is known for sure once it reaches the end
+static void count_free_clusters(FAT32_PARTITION* partition, uint32_t sector, uint32_t* fat){
+    if(sector != partition->counted_sectors)
+        return;
+
+    for (uint32_t i = 0; i < 4; i++) {
+        uint32_t word = used_bits(partition, fat, sector * 128 + i * 32);
+        for (uint32_t bit = 0; bit < 32; bit++)
+            if(!(word & (1u << bit)))
+                partition->counted_free++;
+    }
+    partition->counted_sectors++;
+
+    if(partition->counted_sectors == partition->sectors_per_fat &&
+        partition->fsinfo.free_clusters != partition->counted_free){
+        partition->fsinfo.free_clusters = partition->counted_free;
+        partition->fsinfo_changed = 1;
+    }
+}
+
+static void update_free_space(FAT32_PARTITION* partition, uint32_t cluster, int is_free){
+    uint32_t sector = cluster / 128;
+    uint32_t index = sector - partition->window_start;
+    uint32_t bit = cluster - partition->window_start * 128;
+    if(partition->free_bitmap && sector >= partition->window_start && index < FAT32_BITMAP_WINDOW &&
+        (partition->window_scanned[index / 8] & (1 << (index % 8)))){
+        if(is_free)
+            partition->free_bitmap[bit / 32] &= ~(1u << (bit % 32));
+        else
+            partition->free_bitmap[bit / 32] |= 1u << (bit % 32);
+    }
+    if(sector < partition->counted_sectors)
+        partition->counted_free += is_free ? 1 : -1;
+
+    if(partition->fsinfo.free_clusters != FAT32_FSINFO_UNKNOWN){
+        partition->fsinfo.free_clusters += is_free ? 1 : -1;
+        partition->fsinfo_changed = 1;
+    }
 }
 
-static uint32_t find_empty_cluster(VFS_PARTITION* partition){
+// Looks for a run of count free clusters, returns the longest run found if there is none that long
+static uint32_t find_free_run(VFS_PARTITION* partition, uint32_t count, uint32_t* length){
     FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
-    for (int i = 2; i < fat_partition->sectors_per_fat * 128; i++) {
-        int potential_cluster = get_next_cluster(partition, i);
-        if(potential_cluster == 0){
-            return i;
+    *length = 0;
+    if(fat_partition->fsinfo.free_clusters == 0)
+        return 0;
+
+    uint32_t best = 0, best_length = 0;
+    uint32_t run = 0, run_length = 0;
+
+    // Start where previous allocation ended and wrap around once
+    uint32_t cluster = fat_partition->fsinfo.search_start;
+    uint32_t checked = 0;
+    while(checked < fat_partition->clusters && best_length < count){
+        if(cluster >= fat_partition->clusters){
+            // Runs can't wrap around the end of volume
+            cluster = 2;
+            run_length = 0;
+        }
+
+        // Skip whole words of used clusters at once
+        uint32_t word;
+        if(used_clusters(partition, cluster, &word) != E_DEVICE_OK)
+            break;
+        if(word == 0xFFFFFFFF){
+            uint32_t skip = 32 - cluster % 32;
+            cluster += skip;
+            checked += skip;
+            run_length = 0;
+            continue;
+        }
+
+        if(word & (1u << (cluster % 32))){
+            run_length = 0;
+        }else{
+            if(run_length == 0)
+                run = cluster;
+            run_length++;
+            if(run_length > best_length){
+                best = run;
+                best_length = run_length;
+            }
         }
+        cluster++;
+        checked++;
     }
-    return 0;
+
+    *length = best_length;
+    return best;
 }
 
-static uint32_t allocate_cluster(VFS_PARTITION* partition, uint32_t end_of_cluster){
-    // Find a new cluster
-    uint32_t new_cluster = find_empty_cluster(partition);
-    if(new_cluster == 0) return 0;
+// Appends count clusters to the chain (or starts a new one if end_of_chain is 0), returns first new cluster
+static uint32_t allocate_clusters(VFS_PARTITION* partition, uint32_t end_of_chain, uint32_t count){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    uint32_t first_cluster = 0;
+
+    while(count > 0){
+        // Find as long run of free clusters as possible
+        uint32_t length;
+        uint32_t run = find_free_run(partition, count, &length);
+        if(run == 0)
+            break;
 
-    // Write zeroes to newly allocated cluster
-    uint8_t zero_buffer[512];
-    k_memset(zero_buffer, 512, 0);
-    enum E_DEVICE result = write_cluster(partition, new_cluster, zero_buffer);
-    if(result != E_DEVICE_OK)
-        return 0;
+        // Write zeroes to newly allocated clusters
+        if(zero_clusters(partition, run, length) != E_DEVICE_OK)
+            return first_cluster;
 
-    // Change fat
-    if(end_of_cluster == 0)
-        end_of_cluster = new_cluster;
-    change_fat(partition, end_of_cluster, new_cluster);
+        // Change fat
+        if(link_run(partition, end_of_chain, run, length) != E_DEVICE_OK)
+            return first_cluster;
+        fat_partition->fsinfo.search_start = run + length;
+        fat_partition->fsinfo_changed = 1;
+
+        if(first_cluster == 0)
+            first_cluster = run;
+        end_of_chain = run + length - 1;
+        count -= length;
+    }
 
     // Tidy up
-    return new_cluster;
+    save_fat(partition);
+    return first_cluster;
+}
+
+// Zeroes come from the cluster buffer, which is cleared once for the whole run. Block cache gathers the
+// clusters into longer writes, or drops them if data overwrites them before they're written back
+static enum E_DEVICE zero_clusters(VFS_PARTITION* partition, uint32_t first, uint32_t length){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    k_memset(fat_partition->cluster_buffer, fat_partition->cluster_size, 0);
+    for (uint32_t i = 0; i < length; i++) {
+        enum E_DEVICE result = write_cluster(partition, first + i, fat_partition->cluster_buffer);
+        if(result != E_DEVICE_OK)
+            return result;
+    }
+    return E_DEVICE_OK;
 }
 
 static enum E_DEVICE read_cluster(VFS_PARTITION *partition, uint32_t cluster, void *buffer){
     FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
-    VFS_DEVICE* device = vfs_partition_get_device(partition);
-    return vfs_device_read(device, buffer, 1, fat_partition->data_offset + cluster - 2);
+    return read_cluster_sectors(partition, cluster, buffer, 0, fat_partition->sectors_per_cluster);
 }
 
 static enum E_DEVICE write_cluster(VFS_PARTITION *partition, uint32_t cluster, void *buffer){
     FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    return write_cluster_sectors(partition, cluster, buffer, 0, fat_partition->sectors_per_cluster);
+}
+
+static enum E_DEVICE read_cluster_sectors(VFS_PARTITION *partition, uint32_t cluster, void *buffer,
+                                          uint32_t first, uint32_t count){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    VFS_DEVICE* device = vfs_partition_get_device(partition);
+    return vfs_device_read(device, buffer, count,
+                           fat_partition->data_offset + (cluster - 2) * fat_partition->sectors_per_cluster + first);
+}
+
+static enum E_DEVICE write_cluster_sectors(VFS_PARTITION *partition, uint32_t cluster, void *buffer,
+                                           uint32_t first, uint32_t count){
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
     VFS_DEVICE* device = vfs_partition_get_device(partition);
-    return vfs_device_write(device, buffer, 1, fat_partition->data_offset + cluster - 2);
+    return vfs_device_write(device, buffer, count,
+                            fat_partition->data_offset + (cluster - 2) * fat_partition->sectors_per_cluster + first);
 }
 
 static enum E_DEVICE read_part_cluster(VFS_PARTITION *partition, uint32_t cluster, void *buffer, uint32_t size, uint32_t offset){
-    uint8_t temp_buffer[512];
-    enum E_DEVICE result = read_cluster(partition, cluster, temp_buffer);
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+
+    // Whole cluster goes straight into the caller's buffer
+    if(offset == 0 && size == fat_partition->cluster_size)
+        return read_cluster(partition, cluster, buffer);
+
+    // Otherwise read only sectors covering requested bytes
+    uint32_t first = offset / 512;
+    uint32_t count = (offset + size + 511) / 512 - first;
+    uint8_t* temp_buffer = fat_partition->cluster_buffer;
+    enum E_DEVICE result = read_cluster_sectors(partition, cluster, temp_buffer, first, count);
     if(result != E_DEVICE_OK)
         return result;
-    k_memcpy(&temp_buffer[offset], buffer, size);
-    return E_DEVICE_OK;
-}
-
-static enum E_DEVICE idle_cluster(VFS_PARTITION *partition, uint32_t cluster, void *buffer, uint32_t size,
-                                  uint32_t offset){
+    k_memcpy(&temp_buffer[offset % 512], buffer, size);
     return E_DEVICE_OK;
 }
 
 static enum E_DEVICE write_part_cluster(VFS_PARTITION *partition, uint32_t cluster, void *buffer, uint32_t size, uint32_t offset){
-    uint8_t temp_buffer[512];
-    enum E_DEVICE result = read_cluster(partition, cluster, temp_buffer);
-    if(result != E_DEVICE_OK)
-        return result;
-    k_memcpy(buffer, temp_buffer + offset, size);
-    return write_cluster(partition, cluster, temp_buffer);
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+
+    // Whole cluster is overwritten so there's nothing to preserve
+    if(offset == 0 && size == fat_partition->cluster_size)
+        return write_cluster(partition, cluster, buffer);
+
+    // Only partially covered head and tail sectors have to be read first
+    uint32_t first = offset / 512;
+    uint32_t count = (offset + size + 511) / 512 - first;
+    uint32_t end = (offset % 512) + size;
+    uint8_t* temp_buffer = fat_partition->cluster_buffer;
+    enum E_DEVICE result;
+    if(offset % 512 != 0 || (count == 1 && end % 512 != 0)){
+        result = read_cluster_sectors(partition, cluster, temp_buffer, first, 1);
+        if(result != E_DEVICE_OK)
+            return result;
+    }
+    if(count > 1 && end % 512 != 0){
+        result = read_cluster_sectors(partition, cluster, temp_buffer + (count - 1) * 512, first + count - 1, 1);
+        if(result != E_DEVICE_OK)
+            return result;
+    }
+    k_memcpy(buffer, temp_buffer + offset % 512, size);
+    return write_cluster_sectors(partition, cluster, temp_buffer, first, count);
 }
 
 static uint32_t traverse_fat_coroutine(VFS_PARTITION* partition, void* buffer, uint32_t cluster,
                                        uint32_t size, uint32_t offset,
-                                       CLUSTER_ACTION action, int is_allocating){
+                                       CLUSTER_ACTION action, uint32_t to_allocate){
     if(cluster == 0x0 || cluster >= 0xFFFFFF8)
         return 0;
 
     action(partition, cluster, buffer, size, offset);
     uint32_t new_cluster = get_next_cluster(partition, cluster);
-    if(new_cluster >= 0xFFFFFF8 && is_allocating){
-        cluster = allocate_cluster(partition, cluster);
+    if(new_cluster >= 0xFFFFFF8 && to_allocate){
+        cluster = allocate_clusters(partition, cluster, to_allocate);
+    }else if(new_cluster >= 0xFFFFFF8){
+        cluster = 0; // End of chain
     }else {
         cluster = new_cluster;
     }
@@ -608,7 +1222,8 @@ static enum FAT32_NODE_MATCH compare_directory(struct FAT32_NODE* dir_entry, cha
 
 static FAT32_NODE_INFO find_node_in_directory(VFS_PARTITION* partition, char* filename, struct FAT32_NODE* directory, int is_creating) {
     FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
-    struct FAT32_NODE buffer[512 / sizeof(struct FAT32_NODE)];
+    uint32_t entries_per_cluster = fat_partition->cluster_size / sizeof(struct FAT32_NODE);
+    FAT32_NODE_INFO result = {0, 0, {}};
 
     // Prepare 8.3 name for comparing
     char name83[11];
@@ -616,13 +1231,27 @@ static FAT32_NODE_INFO find_node_in_directory(VFS_PARTITION* partition, char* fi
 
     uint32_t cluster = get_cluster_from_node(fat_partition, directory);
     uint32_t starting_cluster = cluster;
+
+    // Names resolved before need no I/O, creating still has to look for a free slot
+    if(fat32_dentry_lookup(fat_partition->dentry_cache, starting_cluster, (int8_t*)name83, &result) &&
+       (result.descriptor_cluster != 0 || !is_creating))
+        return result;
+
+    // Scan directory only if it can't be indexed
+    FAT32_DIR_INDEX* index = get_directory_index(partition, starting_cluster);
+    if(index)
+        return find_node_in_index(partition, index, name83, starting_cluster, is_creating);
+
+    struct FAT32_NODE* buffer = k_malloc(fat_partition->cluster_size);
     uint32_t new_cluster = cluster;
     int i = 0;
     FAT32_NODE_INFO for_creation = {0, 0, {}};
     while(new_cluster){
         cluster = new_cluster;
-        new_cluster = traverse_fat_coroutine(partition, buffer, cluster, 512, 0, read_part_cluster, 0);
-        for (i = 0; i < 16; i++) {
+        new_cluster = traverse_fat_coroutine(partition, buffer, cluster, fat_partition->cluster_size, 0,
+                                             read_part_cluster, 0);
+        apply_dirty_descriptors(fat_partition, cluster, buffer);
+        for (i = 0; i < entries_per_cluster; i++) {
             switch(compare_directory(&buffer[i], name83)){
                 case FAT32_MATCH_END:
                     goto after_search;
@@ -630,30 +1259,141 @@ static FAT32_NODE_INFO find_node_in_directory(VFS_PARTITION* partition, char* fi
                     continue;
                 case FAT32_MATCH_DIR:
                 case FAT32_MATCH_NOT_DIR:
-                    return (FAT32_NODE_INFO) {cluster, i, buffer[i], starting_cluster};
+                    result = (FAT32_NODE_INFO) {cluster, i, buffer[i], starting_cluster};
+                    fat32_dentry_insert(fat_partition->dentry_cache, starting_cluster, (int8_t*)name83, &result);
+                    goto done;
                 case FAT32_MATCH_DELETED:
                     for_creation = (FAT32_NODE_INFO) {cluster, i, buffer[i], starting_cluster};
             }
         }
     }
     after_search:
-    if(!is_creating)
-        return (FAT32_NODE_INFO) {0, 0, {}};
+    if(!is_creating){
+        fat32_dentry_insert(fat_partition->dentry_cache, starting_cluster, (int8_t*)name83, 0);
+        goto done;
+    }
 
     // If we are creating
     // If we found a deleted entry we can use it
-    if(for_creation.descriptor_cluster != 0)
-        return for_creation;
+    if(for_creation.descriptor_cluster != 0) {
+        result = for_creation;
+        goto done;
+    }
 
     // If we were by the end of the cluster we need to allocated another cluster
-    if(i == 16) {
-        cluster = allocate_cluster(partition, cluster);
+    if(i == entries_per_cluster) {
+        cluster = allocate_clusters(partition, cluster, 1);
         i = 0;
         if(cluster == 0)
-            return (FAT32_NODE_INFO) {0, 0, {}};
+            goto done;
+        k_memset(&buffer[i], sizeof(struct FAT32_NODE), 0);
     }
     buffer[i].filename[0] = (int8_t)0xE5; // Set it as deleted entry to indicated later that this is newly created field
-    return (FAT32_NODE_INFO) {cluster, i, buffer[i], starting_cluster};
+    result = (FAT32_NODE_INFO) {cluster, i, buffer[i], starting_cluster};
+
+    done:
+    k_free(buffer);
+    return result;
+}
+
+static FAT32_NODE_INFO find_node_in_index(VFS_PARTITION* partition, FAT32_DIR_INDEX* index, char* name83,
+                                          uint32_t directory, int is_creating) {
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    FAT32_NODE_INFO result = {0, 0, {}};
+
+    FAT32_DIR_INDEX_ENTRY* entry = fat32_dir_index_lookup(index, (int8_t*)name83);
+    if(entry){
+        result = (FAT32_NODE_INFO) {entry->position.cluster, entry->position.slot, entry->node, directory};
+        fat32_dentry_insert(fat_partition->dentry_cache, directory, (int8_t*)name83, &result);
+        return result;
+    }
+    if(!is_creating){
+        fat32_dentry_insert(fat_partition->dentry_cache, directory, (int8_t*)name83, 0);
+        return result;
+    }
+
+    // Reuse deleted entry or take the one after the last, index is updated once descriptor is saved
+    FAT32_DIR_POSITION position;
+    if(!fat32_dir_index_free_slot(index, &position)){
+        position.cluster = allocate_clusters(partition, index->end.cluster, 1);
+        position.slot = 0;
+        if(position.cluster == 0)
+            return result;
+    }
+    result = (FAT32_NODE_INFO) {position.cluster, position.slot, {}, directory};
+    result.node.filename[0] = (int8_t)0xE5; // Set it as deleted entry to indicated later that this is newly created field
+    return result;
+}
+
+static FAT32_DIR_INDEX* get_directory_index(VFS_PARTITION* partition, uint32_t directory) {
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    FAT32_DIR_INDEX* index = fat32_dir_index_find(fat_partition->dir_indexes, directory);
+    if(index)
+        return index;
+
+    // Build index of the whole directory on first access
+    uint32_t entries_per_cluster = fat_partition->cluster_size / sizeof(struct FAT32_NODE);
+    index = fat32_dir_index_create(fat_partition->dir_indexes, directory, entries_per_cluster);
+    if(!index)
+        return 0;
+    struct FAT32_NODE* buffer = k_malloc(fat_partition->cluster_size);
+    if(!buffer)
+        goto failed;
+
+    uint32_t cluster = directory;
+    uint32_t new_cluster = directory;
+    while(new_cluster){
+        cluster = new_cluster;
+        new_cluster = traverse_fat_coroutine(partition, buffer, cluster, fat_partition->cluster_size, 0,
+                                             read_part_cluster, 0);
+        apply_dirty_descriptors(fat_partition, cluster, buffer);
+        for (uint32_t i = 0; i < entries_per_cluster; i++) {
+            FAT32_DIR_POSITION position = {cluster, i};
+            if(buffer[i].filename[0] == '\0'){
+                index->end = position;
+                goto built;
+            }
+            if((uint8_t)buffer[i].filename[0] == 0xE5){
+                if(fat32_dir_index_add_free(index, position))
+                    goto failed;
+            }else if(buffer[i].attributes != FAT32_DA_LFN){
+                if(fat32_dir_index_add(index, position, &buffer[i]))
+                    goto failed;
+            }
+        }
+    }
+    index->end = (FAT32_DIR_POSITION) {cluster, entries_per_cluster};
+
+    built:
+    k_free(buffer);
+    return index;
+
+    failed:
+    if(buffer)
+        k_free(buffer);
+    fat32_dir_index_drop(index);
+    return 0;
+}
+
+static void remember_node(VFS_PARTITION* partition, FAT32_NODE_INFO* node_info) {
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    if(node_info->node.filename[0] == '\0' || (uint8_t)node_info->node.filename[0] == 0xE5)
+        return;
+
+    fat32_dentry_insert(fat_partition->dentry_cache, node_info->parent_cluster, node_info->node.filename,
+                        node_info);
+    FAT32_DIR_INDEX* index = fat32_dir_index_find(fat_partition->dir_indexes, node_info->parent_cluster);
+    FAT32_DIR_POSITION position = {node_info->descriptor_cluster, node_info->descriptor_offset};
+    if(index && fat32_dir_index_update(index, position, &node_info->node))
+        fat32_dir_index_drop(index);
+}
+
+static void forget_node(VFS_PARTITION* partition, FAT32_NODE_INFO* node_info) {
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    fat32_dentry_insert(fat_partition->dentry_cache, node_info->parent_cluster, node_info->node.filename, 0);
+    FAT32_DIR_INDEX* index = fat32_dir_index_find(fat_partition->dir_indexes, node_info->parent_cluster);
+    if(index && fat32_dir_index_remove(index, node_info->node.filename))
+        fat32_dir_index_drop(index);
 }
 
 static int is_created(FAT32_NODE_INFO* node_info) {
@@ -667,7 +1407,7 @@ static int is_created(FAT32_NODE_INFO* node_info) {
 static int initialize_node(VFS_PARTITION *partition, FAT32_NODE_INFO *node_info, char *filename, int flags) {
     if(!is_created(node_info))
         return 0;
-    uint32_t first_cluster = allocate_cluster(partition, 0);
+    uint32_t first_cluster = allocate_clusters(partition, 0, 1);
     if(first_cluster == 0)
         return 0;
     make_8point3_name(filename, str_len(filename), node_info->node.filename);
@@ -678,7 +1418,7 @@ static int initialize_node(VFS_PARTITION *partition, FAT32_NODE_INFO *node_info,
     enum E_DEVICE result = save_descriptor(partition, node_info);
     if(result != E_DEVICE_OK)
         return 0;
-    result = save_current_fat(partition);
+    result = save_fat(partition);
     return result == E_DEVICE_OK;
 
 }
@@ -687,8 +1427,9 @@ static int initialize_directory_inside(VFS_PARTITION *partition, FAT32_NODE_INFO
     node_info->node.attributes = FAT32_DA_DIR;
     node_info->node.size = 0;
 
-    struct FAT32_NODE buffer[512 / sizeof(struct FAT32_NODE)];
-    k_memset(buffer, 512, 0);
+    FAT32_PARTITION* fat_partition = vfs_partition_get_data(partition);
+    struct FAT32_NODE* buffer = (struct FAT32_NODE*)fat_partition->cluster_buffer;
+    k_memset(buffer, fat_partition->cluster_size, 0);
     for (int i = 0; i < 11; ++i) {
         buffer[0].filename[i] = ' ';
         buffer[1].filename[i] = ' ';
@@ -759,5 +1500,7 @@ static FAT32_NODE_INFO *resolve_path(const char *path, VFS_PARTITION *partition,
     node_info->descriptor_offset = info.descriptor_offset;
     node_info->node = info.node;
     node_info->parent_cluster = info.parent_cluster;
+    node_info->extent_map = (FAT32_EXTENT_MAP) {0, 0, 0, 0};
+    node_info->read_ahead = (FAT32_READ_AHEAD) {0, 0, 0};
     return node_info;
 }
@@ -2,6 +2,7 @@
 #define FAT32_H_
 
 #include "vfs.h"
+#include "fat_cache.h"
 
 enum E_PARTITION     fat32_find_partition(VFS_DEVICE *device);
 
@@ -22,9 +23,26 @@ int                  fat32_remove_dir(VFS_PARTITION *partition, VFS_NODE* dir,
 int                  fat32_write_file (VFS_NODE* node, void* buffer, uint32_t size);
 int                  fat32_read_file  (VFS_NODE* node, void* buffer, uint32_t size);
 int                  fat32_lseek(VFS_NODE* node, int32_t offset, enum SEEK whence);
+int                  fat32_allocate_file(VFS_NODE* node, uint32_t size);
 
 int                  fat32_list_dir   (VFS_NODE* node, DIR_ENTRY* buffer, uint32_t size);
 
+int                  fat32_set_fat_cache_size(VFS_PARTITION* partition, uint32_t sectors);
+
+// Writes FAT, directory entries and FSInfo kept in memory to the device
+int                  fat32_sync(VFS_PARTITION* partition);
+// In write-back mode metadata is flushed by fat32_sync (at least every FAT32_SYNC_INTERVAL_MS), otherwise on every change
+int                  fat32_set_write_back(VFS_PARTITION* partition, int enabled);
+
+#define FAT32_DIRTY_DESCRIPTORS 16
+#define FAT32_SYNC_INTERVAL_MS  5000
+// Bounds of the read-ahead window in bytes, rounded to whole clusters
+#define FAT32_READ_AHEAD_MIN    4096
+#define FAT32_READ_AHEAD_MAX    32768
+
+// FAT sectors described by the free cluster bitmap at once, it moves over the FAT as allocation goes
+#define FAT32_BITMAP_WINDOW 128
+
 struct FAT32_BPB {
     uint8_t  jmp_signature[3];
     uint8_t  oem_identifier[8];
@@ -60,6 +78,11 @@ struct FAT32_EBR {
     uint16_t boot_signature;
 } __attribute__((packed));
 
+#define FAT32_FSINFO_LEAD_SIGNATURE   0x41615252
+#define FAT32_FSINFO_MIDDLE_SIGNATURE 0x61417272
+#define FAT32_FSINFO_TRAIL_SIGNATURE  0xAA550000
+#define FAT32_FSINFO_UNKNOWN          0xFFFFFFFF
+
 struct FAT32_FSINFO {
     uint32_t lead_signature;
     uint8_t  reserved[480];
@@ -103,24 +126,63 @@ struct FAT32_NODE {
     uint32_t size;
 } __attribute__((packed));
 
+// Run of clusters lying one after another both in file and on disk
+typedef struct {
+    uint32_t file_cluster; // Index of the first cluster of the run within the file
+    uint32_t disk_cluster;
+    uint32_t length;
+} FAT32_EXTENT;
+
+// Lazily built map of the cluster chain, always covers a prefix of the chain
+typedef struct {
+    FAT32_EXTENT* extents;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t last_hit; // Extent returned by previous lookup, sequential access resumes from it
+} FAT32_EXTENT_MAP;
+
+// Sequential access detection of an open file
+typedef struct {
+    uint32_t next_offset; // Offset where a sequential read continues
+    uint32_t window;      // Clusters read ahead, 0 until access looks sequential
+    uint32_t end;         // First file cluster not read ahead yet
+} FAT32_READ_AHEAD;
+
 typedef struct  {
     uint32_t descriptor_cluster;
     uint32_t descriptor_offset;
     struct FAT32_NODE node;
     uint32_t parent_cluster;
+    FAT32_EXTENT_MAP extent_map;
+    FAT32_READ_AHEAD read_ahead;
 } FAT32_NODE_INFO;
 
+// Directory entry waiting to be written in write-back mode
+typedef struct {
+    uint32_t cluster;
+    uint32_t offset; // Entry number within the cluster
+    struct FAT32_NODE node;
+} FAT32_DIRTY_DESCRIPTOR;
+
+typedef struct FAT32_DENTRY_CACHE FAT32_DENTRY_CACHE;
+typedef struct FAT32_DIR_INDEX FAT32_DIR_INDEX;
+
 typedef struct {
     uint8_t  sectors_per_cluster;
     uint16_t reserved_sectors; // FAT beginning sector
     uint8_t  FATs;
+    uint8_t  active_fat; // Only FAT in use if mirroring is off
+    int      mirroring;  // Every FAT holds the same table
     uint16_t root_entries;
     uint32_t sectors;
-    uint16_t sectors_per_fat;
+    uint32_t sectors_per_fat;
     uint32_t hidden_sectors;
 
     int8_t label[11];
 
+    uint32_t cluster_size; // Bytes in one cluster
+    uint8_t* cluster_buffer; // 1 cluster sized buffer for partial cluster access
+
     uint32_t fat_offset;
     uint32_t data_offset;
     uint32_t backup_boot_offset;
@@ -129,10 +191,25 @@ typedef struct {
 
     uint32_t root_sector;
 
-    uint32_t buffer[0x80]; // 1 disk sectors sized buffer
-    uint32_t current_sector; // Sector of FAT that was currently loaded
-    int buffer_loaded;
-    int buffer_changed;
+    FAT_CACHE fat_cache; // Recently used FAT sectors
+    FAT32_DENTRY_CACHE* dentry_cache; // Recently resolved names, 0 if it couldn't be allocated
+    FAT32_DIR_INDEX* dir_indexes;     // Hash indexes of recently used directories, 0 if they couldn't be allocated
+
+    uint32_t clusters; // Number of FAT entries describing data clusters (including 2 reserved)
+    struct FAT32_FSINFO fsinfo; // Kept up to date, free_clusters and search_start are live values
+    int fsinfo_valid;
+    int fsinfo_changed;
+
+    uint32_t* free_bitmap;     // Bit set for every cluster of the window in use, 0 if it couldn't be allocated
+    uint32_t  window_start;    // First FAT sector of the window
+    uint8_t   window_scanned[FAT32_BITMAP_WINDOW / 8]; // Bit set for every sector of the window in free_bitmap
+    uint32_t  counted_sectors; // FAT sectors from the beginning whose free clusters are in counted_free
+    uint32_t  counted_free;
+
+    int      write_back; // Metadata is flushed by fat32_sync instead of on every change
+    uint32_t last_sync;  // Timer tick of the last sync
+    FAT32_DIRTY_DESCRIPTOR dirty_descriptors[FAT32_DIRTY_DESCRIPTORS];
+    uint32_t dirty_count;
 
 } FAT32_PARTITION;
 
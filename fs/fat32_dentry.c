@@ -0,0 +1,119 @@
+#include "fat32_dentry.h"
+
+#include "../libc/memory.h"
+#include "../kernel/util.h"
+
+static uint32_t      hash(uint32_t parent_cluster, const int8_t* name);
+static FAT32_DENTRY* find_entry(FAT32_DENTRY_CACHE* cache, uint32_t parent_cluster, const int8_t* name);
+static FAT32_DENTRY* find_victim(FAT32_DENTRY_CACHE* cache);
+static void          unlink_entry(FAT32_DENTRY_CACHE* cache, FAT32_DENTRY* entry);
+
+FAT32_DENTRY_CACHE* fat32_dentry_cache_create(uint32_t size){
+    if(size == 0)
+        return 0;
+    FAT32_DENTRY_CACHE* cache = k_malloc(sizeof(FAT32_DENTRY_CACHE));
+    if(!cache)
+        return 0;
+    cache->entries = k_malloc(size * sizeof(FAT32_DENTRY));
+    if(!cache->entries){
+        k_free(cache);
+        return 0;
+    }
+    for (uint32_t i = 0; i < size; i++)
+        cache->entries[i].valid = 0;
+    for (uint32_t i = 0; i < FAT32_DENTRY_BUCKETS; i++)
+        cache->buckets[i] = 0;
+    cache->size = size;
+    cache->hand = 0;
+    return cache;
+}
+
+int                 fat32_dentry_lookup(FAT32_DENTRY_CACHE* cache, uint32_t parent_cluster, const int8_t* name,
+                                        FAT32_NODE_INFO* info){
+    if(!cache)
+        return 0;
+    FAT32_DENTRY* entry = find_entry(cache, parent_cluster, name);
+    if(!entry)
+        return 0;
+
+    entry->referenced = 1;
+    if(entry->negative)
+        *info = (FAT32_NODE_INFO) {0, 0, {}};
+    else
+        *info = entry->info;
+    return 1;
+}
+
+void                fat32_dentry_insert(FAT32_DENTRY_CACHE* cache, uint32_t parent_cluster, const int8_t* name,
+                                        FAT32_NODE_INFO* info){
+    if(!cache)
+        return;
+    FAT32_DENTRY* entry = find_entry(cache, parent_cluster, name);
+    if(!entry){
+        entry = find_victim(cache);
+        if(entry->valid)
+            unlink_entry(cache, entry);
+
+        uint32_t bucket = hash(parent_cluster, name);
+        entry->parent_cluster = parent_cluster;
+        k_memcpy(name, entry->name, 11);
+        entry->valid = 1;
+        entry->next = cache->buckets[bucket];
+        cache->buckets[bucket] = entry;
+    }
+
+    entry->referenced = 1;
+    entry->negative = info == 0;
+    if(info){
+        // Extent map and read-ahead state belong to an open node, not to the name
+        entry->info = *info;
+        entry->info.extent_map = (FAT32_EXTENT_MAP) {0, 0, 0, 0};
+        entry->info.read_ahead = (FAT32_READ_AHEAD) {0, 0, 0};
+    }
+}
+
+void                fat32_dentry_remove(FAT32_DENTRY_CACHE* cache, uint32_t parent_cluster, const int8_t* name){
+    if(!cache)
+        return;
+    FAT32_DENTRY* entry = find_entry(cache, parent_cluster, name);
+    if(entry)
+        unlink_entry(cache, entry);
+}
+
+///
+/// Static helper functions
+///
+
+static uint32_t      hash(uint32_t parent_cluster, const int8_t* name){
+    uint32_t value = parent_cluster;
+    for (int i = 0; i < 11; i++)
+        value = value * 31 + (uint8_t)name[i];
+    return value % FAT32_DENTRY_BUCKETS;
+}
+
+static FAT32_DENTRY* find_entry(FAT32_DENTRY_CACHE* cache, uint32_t parent_cluster, const int8_t* name){
+    FAT32_DENTRY* entry = cache->buckets[hash(parent_cluster, name)];
+    while(entry && (entry->parent_cluster != parent_cluster || k_memcmp((void*)entry->name, (void*)name, 11)))
+        entry = entry->next;
+    return entry;
+}
+
+static FAT32_DENTRY* find_victim(FAT32_DENTRY_CACHE* cache){
+    // Give recently used entries a second chance
+    while(1){
+        FAT32_DENTRY* entry = &cache->entries[cache->hand];
+        cache->hand = (cache->hand + 1) % cache->size;
+        if(!entry->valid || !entry->referenced)
+            return entry;
+        entry->referenced = 0;
+    }
+}
+
+static void          unlink_entry(FAT32_DENTRY_CACHE* cache, FAT32_DENTRY* entry){
+    FAT32_DENTRY** link = &cache->buckets[hash(entry->parent_cluster, entry->name)];
+    while(*link && *link != entry)
+        link = &(*link)->next;
+    if(*link)
+        *link = entry->next;
+    entry->valid = 0;
+}
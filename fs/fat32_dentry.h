@@ -0,0 +1,37 @@
+#ifndef FAT32_DENTRY_H_
+#define FAT32_DENTRY_H_
+
+#include "fat32.h"
+
+// Names remembered per partition
+#define FAT32_DENTRY_DEFAULT_ENTRIES 128
+#define FAT32_DENTRY_BUCKETS         64
+
+typedef struct FAT32_DENTRY {
+    uint32_t parent_cluster; // First cluster of the directory holding the entry
+    int8_t   name[11];       // 8.3 name as stored on disk
+    uint8_t  valid;
+    uint8_t  negative;       // Name is known not to exist
+    uint8_t  referenced;     // Second chance bit for CLOCK eviction
+    FAT32_NODE_INFO info;
+    struct FAT32_DENTRY* next; // Next entry in the same hash bucket
+} FAT32_DENTRY;
+
+struct FAT32_DENTRY_CACHE {
+    FAT32_DENTRY* entries;
+    uint32_t size;
+    uint32_t hand;
+    FAT32_DENTRY* buckets[FAT32_DENTRY_BUCKETS];
+};
+
+FAT32_DENTRY_CACHE* fat32_dentry_cache_create(uint32_t size);
+
+// Returns 1 if name is cached, info->descriptor_cluster is 0 for names known not to exist
+int                 fat32_dentry_lookup(FAT32_DENTRY_CACHE* cache, uint32_t parent_cluster, const int8_t* name,
+                                        FAT32_NODE_INFO* info);
+// Remembers node (or that name doesn't exist if info is 0), replacing what was cached for the name
+void                fat32_dentry_insert(FAT32_DENTRY_CACHE* cache, uint32_t parent_cluster, const int8_t* name,
+                                        FAT32_NODE_INFO* info);
+void                fat32_dentry_remove(FAT32_DENTRY_CACHE* cache, uint32_t parent_cluster, const int8_t* name);
+
+#endif // FAT32_DENTRY_H_
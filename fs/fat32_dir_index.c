@@ -0,0 +1,221 @@
+#include "fat32_dir_index.h"
+
+#include "../libc/memory.h"
+#include "../kernel/util.h"
+
+static uint32_t hash(const int8_t* name, uint32_t bucket_count);
+static int      rehash(FAT32_DIR_INDEX* index, uint32_t bucket_count);
+static void     link_entry(FAT32_DIR_INDEX* index, int32_t i);
+static void     unlink_entry(FAT32_DIR_INDEX* index, int32_t i);
+static int      same_position(FAT32_DIR_POSITION a, FAT32_DIR_POSITION b);
+
+static uint32_t clock = 0;
+
+FAT32_DIR_INDEX* fat32_dir_index_create_table(){
+    FAT32_DIR_INDEX* table = k_malloc(FAT32_DIR_INDEXES * sizeof(FAT32_DIR_INDEX));
+    if(!table)
+        return 0;
+    for (uint32_t i = 0; i < FAT32_DIR_INDEXES; i++) {
+        table[i].directory = 0;
+        table[i].entries = 0;
+        table[i].buckets = 0;
+        table[i].free_slots = 0;
+    }
+    return table;
+}
+
+FAT32_DIR_INDEX* fat32_dir_index_find(FAT32_DIR_INDEX* table, uint32_t directory){
+    if(!table)
+        return 0;
+    for (uint32_t i = 0; i < FAT32_DIR_INDEXES; i++) {
+        if(table[i].directory == directory){
+            table[i].last_used = ++clock;
+            return &table[i];
+        }
+    }
+    return 0;
+}
+
+FAT32_DIR_INDEX* fat32_dir_index_create(FAT32_DIR_INDEX* table, uint32_t directory, uint32_t entries_per_cluster){
+    if(!table)
+        return 0;
+
+    // Reuse least recently used index
+    FAT32_DIR_INDEX* index = &table[0];
+    for (uint32_t i = 0; i < FAT32_DIR_INDEXES; i++) {
+        if(table[i].directory == 0){
+            index = &table[i];
+            break;
+        }
+        if(table[i].last_used < index->last_used)
+            index = &table[i];
+    }
+    fat32_dir_index_drop(index);
+
+    index->entries_per_cluster = entries_per_cluster;
+    index->count = 0;
+    index->capacity = 0;
+    index->bucket_count = 0;
+    index->free_count = 0;
+    index->free_capacity = 0;
+    index->end = (FAT32_DIR_POSITION) {0, 0};
+    if(rehash(index, 16))
+        return 0;
+    index->directory = directory;
+    index->last_used = ++clock;
+    return index;
+}
+
+void             fat32_dir_index_drop(FAT32_DIR_INDEX* index){
+    if(index->entries)
+        k_free(index->entries);
+    if(index->buckets)
+        k_free(index->buckets);
+    if(index->free_slots)
+        k_free(index->free_slots);
+    index->entries = 0;
+    index->buckets = 0;
+    index->free_slots = 0;
+    index->directory = 0;
+}
+
+int              fat32_dir_index_add(FAT32_DIR_INDEX* index, FAT32_DIR_POSITION position, struct FAT32_NODE* node){
+    // Grow entries and keep buckets short
+    if(index->count == index->capacity){
+        uint32_t capacity = index->capacity ? index->capacity * 2 : 16;
+        FAT32_DIR_INDEX_ENTRY* entries = k_realloc(index->entries, capacity * sizeof(FAT32_DIR_INDEX_ENTRY));
+        if(!entries)
+            return 1;
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+    if(index->count >= index->bucket_count * 2 && rehash(index, index->bucket_count * 4))
+        return 1;
+
+    index->entries[index->count].position = position;
+    index->entries[index->count].node = *node;
+    link_entry(index, (int32_t)index->count);
+    index->count++;
+    return 0;
+}
+
+int              fat32_dir_index_add_free(FAT32_DIR_INDEX* index, FAT32_DIR_POSITION position){
+    if(index->free_count == index->free_capacity){
+        uint32_t capacity = index->free_capacity ? index->free_capacity * 2 : 16;
+        FAT32_DIR_POSITION* free_slots = k_realloc(index->free_slots, capacity * sizeof(FAT32_DIR_POSITION));
+        if(!free_slots)
+            return 1;
+        index->free_slots = free_slots;
+        index->free_capacity = capacity;
+    }
+    index->free_slots[index->free_count++] = position;
+    return 0;
+}
+
+FAT32_DIR_INDEX_ENTRY* fat32_dir_index_lookup(FAT32_DIR_INDEX* index, const int8_t* name){
+    int32_t i = index->buckets[hash(name, index->bucket_count)];
+    while(i >= 0 && k_memcmp((void*)index->entries[i].node.filename, (void*)name, 11))
+        i = index->entries[i].next;
+    return i >= 0 ? &index->entries[i] : 0;
+}
+
+int              fat32_dir_index_free_slot(FAT32_DIR_INDEX* index, FAT32_DIR_POSITION* position){
+    // Prefer deleted entries, then space after the last one
+    if(index->free_count > 0){
+        *position = index->free_slots[index->free_count - 1];
+        return 1;
+    }
+    if(index->end.slot < index->entries_per_cluster){
+        *position = index->end;
+        return 1;
+    }
+    return 0;
+}
+
+int              fat32_dir_index_update(FAT32_DIR_INDEX* index, FAT32_DIR_POSITION position, struct FAT32_NODE* node){
+    FAT32_DIR_INDEX_ENTRY* entry = fat32_dir_index_lookup(index, node->filename);
+    if(entry && same_position(entry->position, position)){
+        entry->node = *node;
+        return 0;
+    }
+    if(entry)
+        return 1; // Same name in two slots, index can't describe that
+
+    // New entry takes a free slot or moves end of directory
+    for (uint32_t i = index->free_count; i > 0; i--) {
+        if(same_position(index->free_slots[i - 1], position)){
+            index->free_slots[i - 1] = index->free_slots[--index->free_count];
+            return fat32_dir_index_add(index, position, node);
+        }
+    }
+    if(same_position(index->end, position) ||
+       (index->end.slot == index->entries_per_cluster && position.slot == 0)){
+        index->end = (FAT32_DIR_POSITION) {position.cluster, position.slot + 1};
+        return fat32_dir_index_add(index, position, node);
+    }
+    return 1;
+}
+
+int              fat32_dir_index_remove(FAT32_DIR_INDEX* index, const int8_t* name){
+    FAT32_DIR_INDEX_ENTRY* entry = fat32_dir_index_lookup(index, name);
+    if(!entry)
+        return 0;
+    if(fat32_dir_index_add_free(index, entry->position))
+        return 1;
+
+    // Move the last entry into the hole
+    int32_t i = (int32_t)(entry - index->entries);
+    int32_t last = (int32_t)index->count - 1;
+    unlink_entry(index, i);
+    if(i != last){
+        unlink_entry(index, last);
+        index->entries[i] = index->entries[last];
+        link_entry(index, i);
+    }
+    index->count--;
+    return 0;
+}
+
+///
+/// Static helper functions
+///
+
+static uint32_t hash(const int8_t* name, uint32_t bucket_count){
+    uint32_t value = 0;
+    for (int i = 0; i < 11; i++)
+        value = value * 31 + (uint8_t)name[i];
+    return value % bucket_count;
+}
+
+static int      rehash(FAT32_DIR_INDEX* index, uint32_t bucket_count){
+    int32_t* buckets = k_malloc(bucket_count * sizeof(int32_t));
+    if(!buckets)
+        return 1;
+    if(index->buckets)
+        k_free(index->buckets);
+    index->buckets = buckets;
+    index->bucket_count = bucket_count;
+    for (uint32_t i = 0; i < bucket_count; i++)
+        buckets[i] = -1;
+    for (uint32_t i = 0; i < index->count; i++)
+        link_entry(index, (int32_t)i);
+    return 0;
+}
+
+static void     link_entry(FAT32_DIR_INDEX* index, int32_t i){
+    uint32_t bucket = hash(index->entries[i].node.filename, index->bucket_count);
+    index->entries[i].next = index->buckets[bucket];
+    index->buckets[bucket] = i;
+}
+
+static void     unlink_entry(FAT32_DIR_INDEX* index, int32_t i){
+    int32_t* link = &index->buckets[hash(index->entries[i].node.filename, index->bucket_count)];
+    while(*link >= 0 && *link != i)
+        link = &index->entries[*link].next;
+    if(*link == i)
+        *link = index->entries[i].next;
+}
+
+static int      same_position(FAT32_DIR_POSITION a, FAT32_DIR_POSITION b){
+    return a.cluster == b.cluster && a.slot == b.slot;
+}
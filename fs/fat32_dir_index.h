@@ -0,0 +1,55 @@
+#ifndef FAT32_DIR_INDEX_H_
+#define FAT32_DIR_INDEX_H_
+
+#include "fat32.h"
+
+// Directories indexed at the same time per partition
+#define FAT32_DIR_INDEXES 8
+
+typedef struct {
+    uint32_t cluster; // Directory cluster holding the entry
+    uint32_t slot;    // Entry number within the cluster
+} FAT32_DIR_POSITION;
+
+typedef struct {
+    FAT32_DIR_POSITION position;
+    struct FAT32_NODE node;
+    int32_t next; // Next entry in the same bucket, -1 ends the chain
+} FAT32_DIR_INDEX_ENTRY;
+
+struct FAT32_DIR_INDEX {
+    uint32_t directory; // First cluster of indexed directory, 0 if index is unused
+    uint32_t last_used;
+    uint32_t entries_per_cluster;
+
+    FAT32_DIR_INDEX_ENTRY* entries;
+    uint32_t count;
+    uint32_t capacity;
+    int32_t* buckets;
+    uint32_t bucket_count;
+
+    FAT32_DIR_POSITION* free_slots; // Deleted entries which can be reused
+    uint32_t free_count;
+    uint32_t free_capacity;
+    FAT32_DIR_POSITION end; // End of directory marker, slot is entries_per_cluster if last cluster is full
+};
+
+FAT32_DIR_INDEX* fat32_dir_index_create_table();
+// Returns index of directory if it's built, 0 otherwise
+FAT32_DIR_INDEX* fat32_dir_index_find(FAT32_DIR_INDEX* table, uint32_t directory);
+// Takes over least recently used index of the table, it has to be filled with add and add_free
+FAT32_DIR_INDEX* fat32_dir_index_create(FAT32_DIR_INDEX* table, uint32_t directory, uint32_t entries_per_cluster);
+void             fat32_dir_index_drop(FAT32_DIR_INDEX* index);
+
+int              fat32_dir_index_add(FAT32_DIR_INDEX* index, FAT32_DIR_POSITION position, struct FAT32_NODE* node);
+int              fat32_dir_index_add_free(FAT32_DIR_INDEX* index, FAT32_DIR_POSITION position);
+
+FAT32_DIR_INDEX_ENTRY* fat32_dir_index_lookup(FAT32_DIR_INDEX* index, const int8_t* name);
+// Returns 1 and position where new entry can be placed, 0 if directory has to grow first
+int              fat32_dir_index_free_slot(FAT32_DIR_INDEX* index, FAT32_DIR_POSITION* position);
+// Records node saved at given position, returns 1 if index couldn't keep up and has to be dropped
+int              fat32_dir_index_update(FAT32_DIR_INDEX* index, FAT32_DIR_POSITION position, struct FAT32_NODE* node);
+// Forgets the name making its slot free
+int              fat32_dir_index_remove(FAT32_DIR_INDEX* index, const int8_t* name);
+
+#endif // FAT32_DIR_INDEX_H_
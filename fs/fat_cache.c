@@ -0,0 +1,209 @@
+#include "fat_cache.h"
+
+#include "../libc/memory.h"
+
+static FAT_CACHE_ENTRY* find_entry(FAT_CACHE* cache, uint32_t sector);
+static FAT_CACHE_ENTRY* find_victim(FAT_CACHE* cache);
+static enum E_DEVICE    save_entry(FAT_CACHE* cache, FAT_CACHE_ENTRY* entry);
+static uint32_t         fat_sector(FAT_CACHE* cache, uint8_t fat, uint32_t sector);
+static int              is_unmirrored(FAT_CACHE* cache, uint32_t sector);
+
+enum E_DEVICE fat_cache_init(FAT_CACHE* cache, VFS_DEVICE* device, uint32_t fat_offset,
+                             uint32_t sectors_per_fat, uint8_t FATs, uint8_t active_fat, int mirroring,
+                             uint32_t size){
+    cache->device = device;
+    cache->fat_offset = fat_offset;
+    cache->sectors_per_fat = sectors_per_fat;
+    cache->FATs = FATs;
+    cache->active_fat = active_fat < FATs ? active_fat : 0;
+    cache->mirroring = mirroring && FATs > 1;
+    cache->unmirrored = 0;
+    cache->mirror_buffer = 0;
+    if(cache->mirroring){
+        cache->unmirrored = k_malloc((sectors_per_fat + 7) / 8);
+        cache->mirror_buffer = k_malloc(FAT_CACHE_MIRROR_RUN * 512);
+        if(cache->unmirrored && cache->mirror_buffer){
+            k_memset(cache->unmirrored, (sectors_per_fat + 7) / 8, 0);
+        }else {
+            // Without bookkeeping copies are written together with the active FAT
+            if(cache->unmirrored)
+                k_free(cache->unmirrored);
+            if(cache->mirror_buffer)
+                k_free(cache->mirror_buffer);
+            cache->unmirrored = 0;
+            cache->mirror_buffer = 0;
+        }
+    }
+    cache->entries = 0;
+    cache->size = 0;
+    cache->clock = 0;
+    cache->last_hit = 0;
+    return fat_cache_resize(cache, size);
+}
+
+enum E_DEVICE fat_cache_resize(FAT_CACHE* cache, uint32_t size){
+    if(size == 0)
+        return E_DEVICE_TOO_SMALL_BUFFER;
+
+    // Write everything back before dropping old entries
+    enum E_DEVICE result = fat_cache_flush(cache);
+    if(result != E_DEVICE_OK)
+        return result;
+
+    FAT_CACHE_ENTRY* entries = k_malloc(size * sizeof(FAT_CACHE_ENTRY));
+    if(!entries)
+        return E_DEVICE_TOO_SMALL_BUFFER;
+    for (uint32_t i = 0; i < size; i++) {
+        entries[i].loaded = 0;
+        entries[i].changed = 0;
+        entries[i].last_used = 0;
+    }
+
+    if(cache->entries)
+        k_free(cache->entries);
+    cache->entries = entries;
+    cache->size = size;
+    cache->last_hit = 0;
+    return E_DEVICE_OK;
+}
+
+enum E_DEVICE fat_cache_load(FAT_CACHE* cache, uint32_t sector, uint8_t** buffer){
+    FAT_CACHE_ENTRY* entry = find_entry(cache, sector);
+    if(!entry){
+        // Make room for the new sector
+        entry = find_victim(cache);
+        enum E_DEVICE result = save_entry(cache, entry);
+        if(result != E_DEVICE_OK)
+            return result;
+
+        // Block cache would only keep a second copy of the sector
+        entry->loaded = 0;
+        result = vfs_device_read_uncached(cache->device, entry->buffer, 1, fat_sector(cache, cache->active_fat, sector));
+        if(result != E_DEVICE_OK)
+            return result;
+        entry->sector = sector;
+        entry->loaded = 1;
+        entry->changed = 0;
+    }
+
+    entry->last_used = ++cache->clock;
+    cache->last_hit = entry;
+    *buffer = entry->buffer;
+    return E_DEVICE_OK;
+}
+
+void          fat_cache_set_changed(FAT_CACHE* cache, uint32_t sector){
+    FAT_CACHE_ENTRY* entry = find_entry(cache, sector);
+    if(entry)
+        entry->changed = 1;
+}
+
+enum E_DEVICE fat_cache_flush(FAT_CACHE* cache){
+    for (uint32_t i = 0; i < cache->size; i++) {
+        enum E_DEVICE result = save_entry(cache, &cache->entries[i]);
+        if(result != E_DEVICE_OK)
+            return result;
+    }
+    return E_DEVICE_OK;
+}
+
+static FAT_CACHE_ENTRY* find_entry(FAT_CACHE* cache, uint32_t sector){
+    // Most accesses hit the same sector as previous one
+    if(cache->last_hit && cache->last_hit->loaded && cache->last_hit->sector == sector)
+        return cache->last_hit;
+
+    for (uint32_t i = 0; i < cache->size; i++)
+        if(cache->entries[i].loaded && cache->entries[i].sector == sector)
+            return &cache->entries[i];
+    return 0;
+}
+
+static FAT_CACHE_ENTRY* find_victim(FAT_CACHE* cache){
+    FAT_CACHE_ENTRY* victim = &cache->entries[0];
+    for (uint32_t i = 0; i < cache->size; i++) {
+        if(!cache->entries[i].loaded)
+            return &cache->entries[i];
+        if(cache->entries[i].last_used < victim->last_used)
+            victim = &cache->entries[i];
+    }
+    return victim;
+}
+
+static enum E_DEVICE save_entry(FAT_CACHE* cache, FAT_CACHE_ENTRY* entry){
+    // If sector didn't change or is not loaded no point in saving it
+    if(!entry->loaded || !entry->changed)
+        return E_DEVICE_OK;
+
+    // Only active FAT is written now, copies are brought up to date by fat_cache_mirror
+    enum E_DEVICE result = vfs_device_write_uncached(cache->device, entry->buffer, 1,
+                                                     fat_sector(cache, cache->active_fat, entry->sector));
+    if(result != E_DEVICE_OK)
+        return result;
+    if(cache->mirroring && cache->unmirrored){
+        cache->unmirrored[entry->sector / 8] |= 1 << (entry->sector % 8);
+    }else if(cache->mirroring){
+        for (uint8_t i = 0; i < cache->FATs; i++) {
+            if(i == cache->active_fat)
+                continue;
+            result = vfs_device_write_uncached(cache->device, entry->buffer, 1, fat_sector(cache, i, entry->sector));
+            if(result != E_DEVICE_OK)
+                return result;
+        }
+    }
+
+    // Unset dirty bit
+    entry->changed = 0;
+    return E_DEVICE_OK;
+}
+
+enum E_DEVICE fat_cache_mirror(FAT_CACHE* cache){
+    if(!cache->mirroring || !cache->unmirrored)
+        return E_DEVICE_OK;
+
+    // Mirror has to match what's on the device
+    enum E_DEVICE result = fat_cache_flush(cache);
+    if(result != E_DEVICE_OK)
+        return result;
+
+    uint32_t sector = 0;
+    while(sector < cache->sectors_per_fat){
+        // Skip whole bytes of clean sectors
+        if(cache->unmirrored[sector / 8] == 0){
+            sector = (sector / 8 + 1) * 8;
+            continue;
+        }
+        if(!is_unmirrored(cache, sector)){
+            sector++;
+            continue;
+        }
+
+        // Copy run of changed sectors at once
+        uint32_t count = 1;
+        while(count < FAT_CACHE_MIRROR_RUN && sector + count < cache->sectors_per_fat &&
+              is_unmirrored(cache, sector + count))
+            count++;
+        result = vfs_device_read_uncached(cache->device, cache->mirror_buffer, count,
+                                          fat_sector(cache, cache->active_fat, sector));
+        if(result != E_DEVICE_OK)
+            return result;
+        for (uint8_t i = 0; i < cache->FATs; i++) {
+            if(i == cache->active_fat)
+                continue;
+            result = vfs_device_write_uncached(cache->device, cache->mirror_buffer, count, fat_sector(cache, i, sector));
+            if(result != E_DEVICE_OK)
+                return result;
+        }
+        for (uint32_t i = 0; i < count; i++)
+            cache->unmirrored[(sector + i) / 8] &= ~(1 << ((sector + i) % 8));
+        sector += count;
+    }
+    return E_DEVICE_OK;
+}
+
+static uint32_t         fat_sector(FAT_CACHE* cache, uint8_t fat, uint32_t sector){
+    return cache->fat_offset + fat * cache->sectors_per_fat + sector;
+}
+
+static int              is_unmirrored(FAT_CACHE* cache, uint32_t sector){
+    return (cache->unmirrored[sector / 8] >> (sector % 8)) & 1;
+}
@@ -0,0 +1,49 @@
+#ifndef FAT_CACHE_H_
+#define FAT_CACHE_H_
+
+#include "vfs.h"
+
+// Default amount of FAT sectors kept in memory per partition
+#define FAT_CACHE_DEFAULT_ENTRIES 16
+// Most FAT sectors copied to other FATs with one request
+#define FAT_CACHE_MIRROR_RUN      16
+
+typedef struct {
+    uint32_t sector;    // Sector relative to the beginning of the FAT
+    uint32_t last_used; // Value of cache clock on last access
+    int loaded;
+    int changed;
+    uint8_t buffer[512];
+} FAT_CACHE_ENTRY;
+
+typedef struct {
+    VFS_DEVICE* device;
+    uint32_t fat_offset;      // First sector of the first FAT
+    uint32_t sectors_per_fat;
+    uint8_t  FATs;
+    uint8_t  active_fat; // FAT which is read and updated right away
+    int      mirroring;  // Other FATs are kept as copies of the active one
+
+    uint8_t* unmirrored; // Bit set for every sector changed in active FAT but not copied to others yet
+    uint8_t* mirror_buffer;
+
+    FAT_CACHE_ENTRY* entries;
+    uint32_t size;
+    uint32_t clock;
+    FAT_CACHE_ENTRY* last_hit;
+} FAT_CACHE;
+
+enum E_DEVICE fat_cache_init(FAT_CACHE* cache, VFS_DEVICE* device, uint32_t fat_offset,
+                             uint32_t sectors_per_fat, uint8_t FATs, uint8_t active_fat, int mirroring,
+                             uint32_t size);
+enum E_DEVICE fat_cache_resize(FAT_CACHE* cache, uint32_t size);
+
+// Returns buffer holding given FAT sector, loading it (and evicting LRU entry) if needed
+enum E_DEVICE fat_cache_load(FAT_CACHE* cache, uint32_t sector, uint8_t** buffer);
+// Marks loaded FAT sector as changed, it will be written back on eviction or flush
+void          fat_cache_set_changed(FAT_CACHE* cache, uint32_t sector);
+enum E_DEVICE fat_cache_flush(FAT_CACHE* cache);
+// Copies sectors changed since last call from active FAT to the other ones
+enum E_DEVICE fat_cache_mirror(FAT_CACHE* cache);
+
+#endif // FAT_CACHE_H_
@@ -0,0 +1,221 @@
+#include "io_scheduler.h"
+
+#include "../libc/memory.h"
+#include "../kernel/util.h"
+#include "../cpu/timer.h"
+
+static int           init_queue(IO_QUEUE* queue);
+static IO_REQUEST*   pick_fifo(IO_QUEUE* queue);
+static IO_REQUEST*   pick_deadline(IO_QUEUE* queue);
+static uint32_t      collect_group(IO_QUEUE* queue, IO_REQUEST* first, IO_REQUEST** group);
+static void          unlink_request(IO_QUEUE* queue, IO_REQUEST* request);
+static enum E_DEVICE transfer(IO_QUEUE* queue, enum IO_DIRECTION direction, void* buffer,
+                              uint32_t sectors, uint32_t lba);
+
+void          io_queue_init(IO_QUEUE* queue, VFS_DEVICE* device, READ_DEVICE read, WRITE_DEVICE write){
+    queue->device = device;
+    queue->read = read;
+    queue->write = write;
+    queue->requests = 0;
+    queue->free = 0;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->count = 0;
+    queue->position = 0;
+    queue->merge_buffer = 0;
+    io_queue_set_scheduler(queue, IO_SCHEDULER_DEADLINE);
+}
+
+void          io_queue_set_scheduler(IO_QUEUE* queue, enum IO_SCHEDULER scheduler){
+    queue->pick = scheduler == IO_SCHEDULER_FIFO ? pick_fifo : pick_deadline;
+}
+
+enum E_DEVICE io_queue_add(IO_QUEUE* queue, enum IO_DIRECTION direction, void* buffer,
+                           uint32_t sectors, uint32_t lba, IO_COMPLETE complete, void* data){
+    IO_REQUEST request = {
+        .direction = direction,
+        .buffer = buffer,
+        .lba = lba,
+        .sectors = sectors,
+        .complete = complete,
+        .data = data,
+    };
+
+    // Without memory for the queue requests are served as they come
+    if(!init_queue(queue)){
+        enum E_DEVICE result = transfer(queue, direction, buffer, sectors, lba);
+        if(complete)
+            complete(&request, result);
+        return result;
+    }
+
+    // Reordering overlapping requests would change what ends up on the device or in the buffer
+    int serve_first = queue->count == IO_QUEUE_DEPTH;
+    for (IO_REQUEST* waiting = queue->head; waiting && !serve_first; waiting = waiting->next)
+        serve_first = lba < waiting->lba + waiting->sectors && waiting->lba < lba + sectors;
+    enum E_DEVICE result = serve_first ? io_queue_run(queue) : E_DEVICE_OK;
+
+    uint32_t frequency = timer_frequency();
+    uint32_t expire_ms = direction == IO_READ ? IO_READ_EXPIRE_MS : IO_WRITE_EXPIRE_MS;
+    IO_REQUEST* queued = queue->free;
+    queue->free = queued->next;
+    *queued = request;
+    queued->expires = timer_ticks() + expire_ms * frequency / 1000;
+    queued->next = 0;
+    if(queue->tail)
+        queue->tail->next = queued;
+    else
+        queue->head = queued;
+    queue->tail = queued;
+    queue->count++;
+    return result;
+}
+
+enum E_DEVICE io_queue_run(IO_QUEUE* queue){
+    enum E_DEVICE first_error = E_DEVICE_OK;
+    IO_REQUEST* group[IO_QUEUE_DEPTH];
+    while(queue->head){
+        uint32_t count = collect_group(queue, queue->pick(queue), group);
+        IO_REQUEST* first = group[0];
+        uint32_t sectors = 0;
+        for (uint32_t i = 0; i < count; i++)
+            sectors += group[i]->sectors;
+
+        // Merged requests go through one buffer
+        enum E_DEVICE result;
+        if(count == 1){
+            result = transfer(queue, first->direction, first->buffer, sectors, first->lba);
+        }else {
+            uint8_t* merged = queue->merge_buffer;
+            if(first->direction == IO_WRITE)
+                for (uint32_t i = 0; i < count; merged += group[i++]->sectors * 512)
+                    k_memcpy(group[i]->buffer, merged, group[i]->sectors * 512);
+            result = transfer(queue, first->direction, queue->merge_buffer, sectors, first->lba);
+            merged = queue->merge_buffer;
+            if(first->direction == IO_READ && result == E_DEVICE_OK)
+                for (uint32_t i = 0; i < count; merged += group[i++]->sectors * 512)
+                    k_memcpy(merged, group[i]->buffer, group[i]->sectors * 512);
+        }
+        if(result != E_DEVICE_OK && first_error == E_DEVICE_OK)
+            first_error = result;
+
+        // Requests go back to the pool before completion so callbacks may queue new ones
+        for (uint32_t i = 0; i < count; i++) {
+            IO_REQUEST served = *group[i];
+            group[i]->next = queue->free;
+            queue->free = group[i];
+            if(served.complete)
+                served.complete(&served, result);
+        }
+    }
+    return first_error;
+}
+
+enum E_DEVICE io_queue_transfer(IO_QUEUE* queue, enum IO_DIRECTION direction, void* buffer,
+                                uint32_t sectors, uint32_t lba){
+    io_queue_run(queue); // Waiting requests report their errors through completion
+    return transfer(queue, direction, buffer, sectors, lba);
+}
+
+///
+/// Static helper functions
+///
+
+static int           init_queue(IO_QUEUE* queue){
+    if(queue->requests)
+        return 1;
+
+    // Allocated on first use, heap isn't ready when devices are registered
+    queue->requests = k_malloc(IO_QUEUE_DEPTH * sizeof(IO_REQUEST));
+    if(!queue->requests)
+        return 0;
+    queue->merge_buffer = k_malloc(IO_MERGE_MAX * 512);
+    for (uint32_t i = 0; i < IO_QUEUE_DEPTH; i++)
+        queue->requests[i].next = i + 1 < IO_QUEUE_DEPTH ? &queue->requests[i + 1] : 0;
+    queue->free = queue->requests;
+    return 1;
+}
+
+static IO_REQUEST*   pick_fifo(IO_QUEUE* queue){
+    return queue->head;
+}
+
+// C-LOOK: the lowest LBA at or after the last transfer, wrapping to the lowest one
+static IO_REQUEST*   pick_deadline(IO_QUEUE* queue){
+    if(timer_frequency() && (int32_t)(timer_ticks() - queue->head->expires) >= 0)
+        return queue->head;
+
+    IO_REQUEST* ahead = 0;
+    IO_REQUEST* lowest = 0;
+    for (IO_REQUEST* request = queue->head; request; request = request->next) {
+        if(request->lba >= queue->position && (!ahead || request->lba < ahead->lba))
+            ahead = request;
+        if(!lowest || request->lba < lowest->lba)
+            lowest = request;
+    }
+    return ahead ? ahead : lowest;
+}
+
+// Takes request and waiting ones adjacent to it out of the queue, returns them sorted by LBA
+static uint32_t      collect_group(IO_QUEUE* queue, IO_REQUEST* first, IO_REQUEST** group){
+    unlink_request(queue, first);
+    group[0] = first;
+    uint32_t count = 1;
+    if(!queue->merge_buffer)
+        return count;
+
+    uint32_t start = first->lba;
+    uint32_t end = first->lba + first->sectors;
+    int merged = 1;
+    while(merged){
+        merged = 0;
+        for (IO_REQUEST* request = queue->head; request; request = request->next) {
+            if(request->direction != first->direction || end - start + request->sectors > IO_MERGE_MAX)
+                continue;
+            if(request->lba == end){
+                end += request->sectors;
+                group[count++] = request;
+            }else if(request->lba + request->sectors == start){
+                start = request->lba;
+                for (uint32_t i = count; i > 0; i--)
+                    group[i] = group[i - 1];
+                group[0] = request;
+                count++;
+            }else
+                continue;
+            unlink_request(queue, request);
+            merged = 1;
+            break;
+        }
+    }
+    return count;
+}
+
+static void          unlink_request(IO_QUEUE* queue, IO_REQUEST* request){
+    IO_REQUEST* previous = 0;
+    IO_REQUEST* current = queue->head;
+    while(current && current != request){
+        previous = current;
+        current = current->next;
+    }
+    if(!current)
+        return;
+    if(previous)
+        previous->next = request->next;
+    else
+        queue->head = request->next;
+    if(queue->tail == request)
+        queue->tail = previous;
+    queue->count--;
+}
+
+static enum E_DEVICE transfer(IO_QUEUE* queue, enum IO_DIRECTION direction, void* buffer,
+                              uint32_t sectors, uint32_t lba){
+    enum E_DEVICE result;
+    if(direction == IO_READ)
+        result = queue->read ? queue->read(queue->device, buffer, sectors, lba) : E_DEVICE_NOT_READABLE;
+    else
+        result = queue->write ? queue->write(queue->device, buffer, sectors, lba) : E_DEVICE_NOT_WRITABLE;
+    queue->position = lba + sectors;
+    return result;
+}
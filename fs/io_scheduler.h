@@ -0,0 +1,72 @@
+#ifndef IO_SCHEDULER_H_
+#define IO_SCHEDULER_H_
+
+#include "vfs.h"
+
+// Requests waiting in one device queue, a full queue is served right away
+#define IO_QUEUE_DEPTH     64
+// Most sectors adjacent requests are merged into
+#define IO_MERGE_MAX       16
+// Deadline scheduler serves requests waiting longer than this before continuing its sweep
+#define IO_READ_EXPIRE_MS  500
+#define IO_WRITE_EXPIRE_MS 5000
+
+enum IO_SCHEDULER {
+    IO_SCHEDULER_FIFO     = 0, // Submission order, for devices without seek cost
+    IO_SCHEDULER_DEADLINE = 1, // Sweeps towards higher LBAs, expired requests go first
+};
+
+enum IO_DIRECTION {
+    IO_READ  = 0,
+    IO_WRITE = 1,
+};
+
+typedef struct IO_REQUEST IO_REQUEST;
+// Called once request is served, may not start any I/O on the device
+typedef void (*IO_COMPLETE)(IO_REQUEST* request, enum E_DEVICE result);
+
+struct IO_REQUEST {
+    enum IO_DIRECTION direction;
+    uint8_t* buffer;
+    uint32_t lba;
+    uint32_t sectors;
+    IO_COMPLETE complete; // May be 0
+    void* data;           // Not used by the scheduler
+
+    uint32_t expires; // Timer tick by which the request should be served
+    IO_REQUEST* next; // Next request in submission order
+};
+
+// Picks request to serve next from a non empty queue
+typedef IO_REQUEST* (*IO_PICK)(IO_QUEUE* queue);
+
+struct IO_QUEUE {
+    VFS_DEVICE*  device;
+    READ_DEVICE  read;
+    WRITE_DEVICE write;
+    IO_PICK      pick;
+
+    IO_REQUEST*  requests; // IO_QUEUE_DEPTH requests, allocated on first use
+    IO_REQUEST*  free;
+    IO_REQUEST*  head;     // Oldest waiting request
+    IO_REQUEST*  tail;
+    uint32_t     count;
+    uint32_t     position; // LBA following the last one transferred
+
+    uint8_t*     merge_buffer; // Gathers merged requests, 0 if they couldn't be allocated
+};
+
+void          io_queue_init(IO_QUEUE* queue, VFS_DEVICE* device, READ_DEVICE read, WRITE_DEVICE write);
+void          io_queue_set_scheduler(IO_QUEUE* queue, enum IO_SCHEDULER scheduler);
+
+// Queues transfer till io_queue_run, buffer has to stay valid till completion.
+// Requests overlapping a waiting one are served in order, queue is run first
+enum E_DEVICE io_queue_add(IO_QUEUE* queue, enum IO_DIRECTION direction, void* buffer,
+                           uint32_t sectors, uint32_t lba, IO_COMPLETE complete, void* data);
+// Serves every waiting request in scheduler's order, returns first error
+enum E_DEVICE io_queue_run(IO_QUEUE* queue);
+// Transfers right away after serving what is waiting
+enum E_DEVICE io_queue_transfer(IO_QUEUE* queue, enum IO_DIRECTION direction, void* buffer,
+                                uint32_t sectors, uint32_t lba);
+
+#endif // IO_SCHEDULER_H_
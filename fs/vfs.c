@@ -6,6 +6,9 @@
 #include "../libc/strings.h"
 #include "../libc/memory.h"
 #include "fat32.h"
+#include "fat12.h"
+#include "block_cache.h"
+#include "io_scheduler.h"
 
 ///
 /// Type declarations
@@ -18,6 +21,9 @@ struct VFS_DEVICE {
     // Methods
     READ_DEVICE  read;
     WRITE_DEVICE write;
+
+    // Transfers waiting to be sorted and merged
+    IO_QUEUE queue;
 };
 
 struct VFS_PARTITION {
@@ -38,6 +44,8 @@ struct VFS_PARTITION {
     OPEN_DIR    open_dir;
     MAKE_DIR    make_dir;
     RMV_DIR     remove_dir;
+
+    SYNC_PARTITION sync;
 };
 
 struct VFS_NODE {
@@ -54,6 +62,7 @@ struct VFS_NODE {
     WRITE_FILE  write_file;
     READ_FILE   read_file;
     LSEEK       lseek;
+    ALLOCATE_FILE allocate_file;
 
     // Folder methods
     LIST_DIR    list_dir;
@@ -95,6 +104,7 @@ enum E_DEVICE vfs_device_register(void *device_data, READ_DEVICE read, WRITE_DEV
     };
     virtual_devices[virtual_devices_count] = new_device;
     *dd = virtual_devices + virtual_devices_count;
+    io_queue_init(&(*dd)->queue, *dd, read, write);
     virtual_devices_count++;
     return E_DEVICE_OK;
 }
@@ -108,7 +118,7 @@ enum E_DEVICE vfs_device_read(VFS_DEVICE* device, void* buffer, uint32_t sectors
         return E_DEVICE_TOO_SMALL_BUFFER;
     if(sectors == 0)
         return E_DEVICE_BAD_READ;
-    return device->read(device, buffer, sectors, lba);
+    return block_cache_read(device, buffer, sectors, lba);
 }
 
 enum E_DEVICE vfs_device_write(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
@@ -120,7 +130,59 @@ enum E_DEVICE vfs_device_write(VFS_DEVICE* device, void* buffer, uint32_t sector
         return E_DEVICE_TOO_SMALL_BUFFER;
     if(sectors == 0)
         return E_DEVICE_BAD_WRITE;
-    return device->write(device, buffer, sectors, lba);
+    return block_cache_write(device, buffer, sectors, lba);
+}
+
+enum E_DEVICE vfs_device_read_uncached(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
+    if(!device)
+        return E_DEVICE_NOT_FOUND;
+    if(!device->read)
+        return E_DEVICE_NOT_READABLE;
+    if(!buffer)
+        return E_DEVICE_TOO_SMALL_BUFFER;
+    if(sectors == 0)
+        return E_DEVICE_BAD_READ;
+    return block_cache_read_uncached(device, buffer, sectors, lba);
+}
+
+enum E_DEVICE vfs_device_write_uncached(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
+    if(!device)
+        return E_DEVICE_NOT_FOUND;
+    if(!device->write)
+        return E_DEVICE_NOT_WRITABLE;
+    if(!buffer)
+        return E_DEVICE_TOO_SMALL_BUFFER;
+    if(sectors == 0)
+        return E_DEVICE_BAD_WRITE;
+    return block_cache_write_uncached(device, buffer, sectors, lba);
+}
+
+enum E_DEVICE vfs_device_prefetch(VFS_DEVICE* device, uint32_t sectors, uint32_t lba){
+    if(!device)
+        return E_DEVICE_NOT_FOUND;
+    if(!device->read)
+        return E_DEVICE_NOT_READABLE;
+    return block_cache_prefetch(device, sectors, lba);
+}
+
+enum E_DEVICE vfs_device_read_direct(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
+    if(!device)
+        return E_DEVICE_NOT_FOUND;
+    if(!device->read)
+        return E_DEVICE_NOT_READABLE;
+    return io_queue_transfer(&device->queue, IO_READ, buffer, sectors, lba);
+}
+
+enum E_DEVICE vfs_device_write_direct(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba){
+    if(!device)
+        return E_DEVICE_NOT_FOUND;
+    if(!device->write)
+        return E_DEVICE_NOT_WRITABLE;
+    return io_queue_transfer(&device->queue, IO_WRITE, buffer, sectors, lba);
+}
+
+enum E_DEVICE vfs_device_sync(VFS_DEVICE* device){
+    return block_cache_sync(device);
 }
 
 void*         vfs_device_get_data(VFS_DEVICE* device){
@@ -129,6 +191,12 @@ void*         vfs_device_get_data(VFS_DEVICE* device){
     return device->device_data;
 }
 
+IO_QUEUE*     vfs_device_get_queue(VFS_DEVICE* device){
+    if(!device)
+        return 0;
+    return &device->queue;
+}
+
 ///
 /// Partitions
 ///
@@ -136,10 +204,9 @@ void*         vfs_device_get_data(VFS_DEVICE* device){
 enum E_PARTITION vfs_partitions_find_on_device(struct VFS_DEVICE* dev, enum PARTITION_FORMAT format,
                                                struct VFS_PARTITION** parts, uint32_t* size){
     int current_partitions_count = partitions_count;
-    if(format & PARTITION_FORMAT_FAT12)
-        ;
-    if(format & PARTITION_FORMAT_FAT16)
-        ;
+    // Both are handled by one driver, type of the volume decides which one it is
+    if(format & (PARTITION_FORMAT_FAT12 | PARTITION_FORMAT_FAT16))
+        fat12_find_partition(dev, format);
     if(format & PARTITION_FORMAT_FAT32)
         fat32_find_partition(dev);
     if(format & PARTITION_FORMAT_EXFAT)
@@ -153,7 +220,7 @@ enum E_PARTITION vfs_partitions_find_on_device(struct VFS_DEVICE* dev, enum PART
 
 enum E_PARTITION vfs_register_partition(void* data, struct VFS_DEVICE* dev, OPEN_FILE open, CREATE_FILE crat,
                                         RMV_FILE rm, OPEN_DIR open_dir, MAKE_DIR mkdir, RMV_DIR rmdir,
-                                        struct VFS_PARTITION* p){
+                                        SYNC_PARTITION sync, struct VFS_PARTITION* p){
     if(!data || !dev || !open || !crat || !rm || !open_dir || !mkdir || !rmdir)
         return E_PARTITION_NO_FILESYSTEM_DETECTED;
     VFS_PARTITION tmp_partition = {
@@ -165,6 +232,7 @@ enum E_PARTITION vfs_register_partition(void* data, struct VFS_DEVICE* dev, OPEN
          .open_dir = open_dir,
          .make_dir = mkdir,
          .remove_dir = rmdir,
+         .sync = sync,
          .letter = 'A' + partitions_count,
     };
     partitions[partitions_count] = tmp_partition;
@@ -194,7 +262,7 @@ VFS_DEVICE*      vfs_partition_get_device(VFS_PARTITION* partition){
 
 enum E_FILE vfs_file_create_descriptor(void* data, VFS_PARTITION* partition,
                                        WRITE_FILE write, READ_FILE read, LSEEK lseek,
-                                       LIST_DIR list, VFS_NODE** file_descriptor){
+                                       ALLOCATE_FILE allocate, LIST_DIR list, VFS_NODE** file_descriptor){
     if(!data || (!write && !read && !list))
         return E_FILE_NOT_FOUND;
     *file_descriptor = k_malloc(sizeof(VFS_NODE));
@@ -203,7 +271,9 @@ enum E_FILE vfs_file_create_descriptor(void* data, VFS_PARTITION* partition,
     (*file_descriptor)->read_file = read;
     (*file_descriptor)->write_file = write;
     (*file_descriptor)->lseek = lseek;
+    (*file_descriptor)->allocate_file = allocate;
     (*file_descriptor)->list_dir = list;
+    (*file_descriptor)->offset = 0;
     return E_FILE_OK;
 }
 void* vfs_node_get_data(struct VFS_NODE* node){
@@ -310,6 +380,25 @@ int             lseek(VFS_NODE* node, int32_t offset, enum SEEK whence) {
     return node->lseek(node, offset, whence);
 }
 
+// Reserves space for at least size bytes, growing the file if needed
+int             allocate_file(VFS_NODE* node, uint32_t size){
+    if(!node)
+        return -1;
+    if(!node->allocate_file)
+        return -2;
+    return node->allocate_file(node, size);
+}
+
+// Writes back everything cached for partition of the node
+int             fsync(VFS_NODE* node){
+    if(!node)
+        return -1;
+    VFS_PARTITION* partition = node->partition;
+    if(partition->sync && partition->sync(partition))
+        return -2;
+    return vfs_device_sync(partition->device) != E_DEVICE_OK ? -2 : 0;
+}
+
 int             read_file  (struct VFS_NODE* node, void* buffer, uint32_t size){
     if(!node)
         return -1;
@@ -379,6 +468,31 @@ int             list_dir (struct VFS_NODE* node, struct DIR_ENTRY* buffer, uint3
     return node->list_dir(node, buffer, size);
 }
 
+// Partition methods
+int             sync(){
+    int result = 0;
+    for (int i = 0; i < partitions_count; i++)
+        if(partitions[i].letter != '\0' && partitions[i].sync && partitions[i].sync(&partitions[i]))
+            result = -1;
+    if(vfs_device_sync(0) != E_DEVICE_OK)
+        result = -1;
+    return result;
+}
+
+int             unmount(char* path){
+    struct VFS_PARTITION* partition = get_partition_from_path(path);
+    if(!partition)
+        return -1;
+    if(partition->sync && partition->sync(partition))
+        return -2;
+    if(vfs_device_sync(partition->device) != E_DEVICE_OK)
+        return -2;
+
+    // Letter stays taken but paths on it no longer resolve
+    partition->letter = '\0';
+    return 0;
+}
+
 static struct VFS_PARTITION* get_partition_from_path(const char* path){
     if(*path < 'A' || *path > 'Z')
         return 0;
@@ -12,6 +12,7 @@
 ///
 
 typedef struct VFS_DEVICE VFS_DEVICE;
+typedef struct IO_QUEUE IO_QUEUE;
 typedef struct VFS_PARTITION VFS_PARTITION;
 typedef struct VFS_NODE VFS_NODE;
 typedef struct DIR_ENTRY DIR_ENTRY;
@@ -128,10 +129,14 @@ typedef int              (*MAKE_DIR)   (VFS_PARTITION*, VFS_NODE* dir,
 typedef int              (*RMV_DIR)    (VFS_PARTITION*, VFS_NODE* dir,
                                         char* path);
 
+// Writes everything partition keeps in memory to its device
+typedef int              (*SYNC_PARTITION)(VFS_PARTITION*);
+
 // Node functions (file-only)
 typedef int              (*WRITE_FILE) (VFS_NODE* node, void* buffer, uint32_t size);
 typedef int              (*READ_FILE)  (VFS_NODE* node, void* buffer, uint32_t size);
 typedef int              (*LSEEK)      (VFS_NODE* node, int32_t offset, enum SEEK whence);
+typedef int              (*ALLOCATE_FILE)(VFS_NODE* node, uint32_t size);
 
 // Node functions (directory-only)
 typedef int              (*LIST_DIR)   (VFS_NODE* node, DIR_ENTRY* buffer, uint32_t size);
@@ -149,7 +154,19 @@ enum E_DEVICE vfs_device_register(void* device_data, READ_DEVICE, WRITE_DEVICE,
                                 VFS_DEVICE** device_descriptor);
 enum E_DEVICE vfs_device_read(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
 enum E_DEVICE vfs_device_write(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+// Leave sectors out of the block cache, for callers caching them on their own
+enum E_DEVICE vfs_device_read_uncached(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+enum E_DEVICE vfs_device_write_uncached(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+// Reads sectors into the block cache ahead of their use
+enum E_DEVICE vfs_device_prefetch(VFS_DEVICE* device, uint32_t sectors, uint32_t lba);
+// Bypass the block cache, meant for the cache itself
+enum E_DEVICE vfs_device_read_direct(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+enum E_DEVICE vfs_device_write_direct(VFS_DEVICE* device, void* buffer, uint32_t sectors, uint32_t lba);
+// Writes back cached sectors of a device, of every device if device is 0
+enum E_DEVICE vfs_device_sync(VFS_DEVICE* device);
 void*         vfs_device_get_data(VFS_DEVICE* device);
+// Requests waiting for the device, see io_scheduler.h
+IO_QUEUE*     vfs_device_get_queue(VFS_DEVICE* device);
 
 // Partition methods
 enum E_PARTITION vfs_partitions_find_on_device(VFS_DEVICE* partition,
@@ -159,7 +176,7 @@ enum E_PARTITION vfs_partitions_find_on_device(VFS_DEVICE* partition,
 enum E_PARTITION vfs_register_partition(void* data,
                                         VFS_DEVICE*,
                                         OPEN_FILE, CREATE_FILE,RMV_FILE,
-                                        OPEN_DIR, MAKE_DIR, RMV_DIR,
+                                        OPEN_DIR, MAKE_DIR, RMV_DIR, SYNC_PARTITION,
                                         VFS_PARTITION* partition_descriptor);
 void*            vfs_partition_get_data(VFS_PARTITION* partition);
 char             vfs_partition_get_name(VFS_PARTITION* partition);
@@ -167,7 +184,8 @@ VFS_DEVICE*      vfs_partition_get_device(VFS_PARTITION* partition);
 
 // File Methods
 enum E_FILE vfs_file_create_descriptor(void* data, VFS_PARTITION* partition,
-                                       WRITE_FILE, READ_FILE, LSEEK lseek, LIST_DIR, VFS_NODE** file_descriptor);
+                                       WRITE_FILE, READ_FILE, LSEEK lseek, ALLOCATE_FILE, LIST_DIR,
+                                       VFS_NODE** file_descriptor);
 void*            vfs_node_get_data(VFS_NODE* node);
 VFS_PARTITION* vfs_node_get_partition(VFS_NODE* node);
 int32_t vfs_node_get_offset(VFS_NODE* node);
@@ -188,6 +206,8 @@ int             rmv_file_relative (VFS_NODE* dir, char* path);
 int             write_file (VFS_NODE* node, void* buffer, uint32_t size);
 int             read_file  (VFS_NODE* node, void* buffer, uint32_t size);
 int             lseek(VFS_NODE* node, int32_t offset, enum SEEK whence);
+int             allocate_file(VFS_NODE* node, uint32_t size);
+int             fsync(VFS_NODE* node);
 
 
 // Folder intermethods methods
@@ -199,6 +219,10 @@ int             rmv_dir  (char* path);
 int             rmv_dir_relative  (VFS_NODE* dir, char* path);
 int             list_dir (VFS_NODE* node, DIR_ENTRY* buffer, uint32_t size);
 
+// Partition methods
+int             sync();
+int             unmount(char* path);
+
 
 
 struct DIR_ENTRY{
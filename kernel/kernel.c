@@ -12,6 +12,10 @@
 #include "../libc/stdout.h"
 #include "../task/task.h"
 #include "../drivers/ata/ata.h"
+#include "../fs/vfs.h"
+
+#define TIMER_FREQUENCY     100
+#define SYNC_INTERVAL_TICKS (5 * TIMER_FREQUENCY)
 
 uintptr_t __stack_chk_guard = 0x1234fedc;
 
@@ -61,12 +65,22 @@ void main() {
     clear_screen();
     kprint("Hello to File OS! \n\n");
     __asm__ __volatile__("sti");
+    timer_start(TIMER_FREQUENCY);
     floppy_init(Floppy_PIO);
-    ata_init(ATA_PIO);
+    ata_init(ATA_DMA);
     initialise_multitasking();
 
     kprint(&current_path[0]);
     kprint("> ");
 
-    while(1);
+    uint32_t last_sync = timer_ticks();
+    while(1){
+        __asm__ __volatile__("hlt");
+
+        // Write back what file systems keep in memory every few seconds
+        if(timer_ticks() - last_sync >= SYNC_INTERVAL_TICKS){
+            sync();
+            last_sync = timer_ticks();
+        }
+    }
 }
\ No newline at end of file
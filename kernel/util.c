@@ -7,6 +7,11 @@
 
 void k_memcpy(const void *source, void *dest, int bytes){
     const uint8_t* s = source;uint8_t* d = dest;
+    // Copy whole words when both buffers are aligned, sector sized copies are the common case
+    if((((uintptr_t)s | (uintptr_t)d) & 3) == 0){
+        for (; bytes >= 4; bytes -= 4, s += 4, d += 4)
+            *(uint32_t*)d = *(const uint32_t*)s;
+    }
     for (int i = 0; i < bytes; ++i)
         d[i] = s[i];
 }